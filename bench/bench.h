@@ -0,0 +1,138 @@
+/*
+ * Benchmark harness
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ *
+ * Description:
+ *
+ *      What the benchmarks run by `make bench` share: timing, counting
+ *      allocations, and printing one line per case in the format Go's
+ *      testing package uses, so results can be diffed between commits or
+ *      fed to benchstat as they are:
+ *
+ *          Benchmark<Group>/<case>  <iterations>  <n> ns/op  <n> allocs/op  [<n> bytes/frame]
+ *
+ *      (fields separated by tabs).  Names and units don't change between
+ *      runs; only the numbers do.
+ *
+ *      Allocations are counted by replacing the global operator new, so
+ *      include this in exactly one file per benchmark binary.
+ */
+
+#ifndef BENCH_BENCH_H
+#define BENCH_BENCH_H
+
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <string>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace std;
+
+// every operator new since the program started
+atomic<size_t> benchAllocations(0);
+
+// results go here, which stays the real stdout even once benchQuiet()
+// has pointed STDOUT_FILENO at /dev/null
+FILE* benchReport = stdout;
+
+// work results are added here so the compiler can't drop the work
+volatile size_t benchSink = 0;
+
+void* operator new(size_t size) {
+   benchAllocations.fetch_add(1, memory_order_relaxed);
+   void* p = malloc(size ? size : 1);
+   if (!p) {
+      throw bad_alloc();
+   }
+   return p;
+}
+
+// once these are inlined, gcc sees free() of what it thinks is the
+// library's operator new and warns, wrongly
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* p) noexcept {
+   free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+   free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+struct benchResult {
+   size_t iterations;
+   double nanoseconds;  // per op
+   double allocations;  // per op
+};
+
+/**
+ * @function benchQuiet
+ * For benchmarks of code that writes to the terminal: STDOUT_FILENO goes
+ * to /dev/null from here on, and the report to a copy of the original.
+ */
+void benchQuiet() {
+   int original = dup(STDOUT_FILENO);
+   int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+   if (original < 0 || null < 0) {
+      return;
+   }
+   fflush(stdout);
+   benchReport = fdopen(original, "w");
+   dup2(null, STDOUT_FILENO);
+   close(null);
+}
+
+/**
+ * @function benchMeasure
+ * Calls work() once to warm up, then iterations times.
+ * @param {size_t} iterations - how many times to time it.
+ * @param {Work} work - what to time; called with the iteration number.
+ * @returns {benchResult} time and allocations per call.
+ */
+template<typename Work>
+benchResult benchMeasure(size_t iterations, Work work) {
+   work((size_t) 0);
+
+   size_t allocations = benchAllocations.load();
+   auto start = chrono::steady_clock::now();
+   for (size_t i = 0; i < iterations; i++) {
+      work(i);
+   }
+   auto elapsed = chrono::steady_clock::now() - start;
+   allocations = benchAllocations.load() - allocations;
+
+   return {iterations, chrono::duration<double, nano>(elapsed).count() / iterations,
+           (double) allocations / iterations};
+}
+
+/**
+ * @function benchPrint
+ * Reports one case.
+ * @param {const string&} name - e.g. "Parm/cup/rparm".
+ * @param {const benchResult&} result - from benchMeasure.
+ * @param {double} bytesPerFrame - bytes sent to the terminal per op, or
+ * negative to leave the column out.
+ */
+void benchPrint(const string& name, const benchResult& result, double bytesPerFrame = -1) {
+   fprintf(benchReport, "Benchmark%s\t%zu\t%.1f ns/op\t%.2f allocs/op", name.c_str(),
+           result.iterations, result.nanoseconds, result.allocations);
+   if (bytesPerFrame >= 0) {
+      fprintf(benchReport, "\t%.1f bytes/frame", bytesPerFrame);
+   }
+   fprintf(benchReport, "\n");
+   fflush(benchReport);
+}
+
+#endif
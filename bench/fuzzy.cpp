@@ -0,0 +1,75 @@
+/*
+ * Benchmark: fuzzy
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ *
+ * Description:
+ *
+ *      Times rfuzzy the way menu's filter mode uses it: a pattern typed
+ *      one key at a time over a big directory, then backspaced away.
+ *      Every keystroke has to fit in a frame (16.7 ms) to feel live;
+ *      ns/op is per keystroke.
+ *
+ *      Usage: build/bench_fuzzy [rounds] [items]
+ */
+
+#include <string>
+#include <vector>
+
+#include "../include/ritems.h"
+#include "../include/rfuzzy.h"
+#include "bench.h"
+
+using namespace std;
+
+/**
+ * @function makeItems
+ * Names like a recordings directory plus some odds and ends.
+ */
+void makeItems(ritems& items, size_t count) {
+   const char* stems[] = {
+      "recording-%06zu.mid", "log-2021-04-%02zu-%06zu.txt", "Notes %zu.txt",
+      "build_%zu.sh", "résumé-%zu.pdf", "日本語-%zu.txt", "IMG_%06zu.JPG"
+   };
+   char name[128];
+   for (size_t i = 0; i < count; i++) {
+      size_t stem = i % (sizeof stems / sizeof stems[0]);
+      if (stem == 1) {
+         snprintf(name, sizeof name, stems[stem], i % 30 + 1, i);
+      } else {
+         snprintf(name, sizeof name, stems[stem], i);
+      }
+      items.push_back(name, (stem == 3) ? RI_EXECUTABLE : RI_NONE);
+   }
+}
+
+int main(int argc, char** argv) {
+   size_t rounds = (argc > 1) ? stoul(argv[1]) : 5;
+   size_t count = (argc > 2) ? stoul(argv[2]) : 100000;
+
+   ritems items;
+   makeItems(items, count);
+   rfuzzy fuzzy(&items);
+
+   const string typed[] = {"log2021", "rec99", "notes", "img0001"};
+   string size = to_string(count / 1000) + "k";
+
+   for (const string& pattern : typed) {
+      // type it in, then backspace it out
+      vector<string> keys;
+      for (size_t length = 1; length <= pattern.length(); length++) {
+         keys.push_back(pattern.substr(0, length));
+      }
+      for (size_t length = pattern.length() - 1; length > 0; length--) {
+         keys.push_back(pattern.substr(0, length));
+      }
+
+      // the first key also builds the masks, so that's left to the warm-up
+      fuzzy.invalidate();
+      benchPrint("Fuzzy/" + size + "/" + pattern, benchMeasure(rounds * keys.size(), [&](size_t i) {
+         benchSink += fuzzy.filter(keys[i % keys.size()]).size();
+      }));
+   }
+
+   return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * Benchmark: keyboard
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ *
+ * Description:
+ *
+ *      The input side: how long a key takes to come out of rkeyboard,
+ *      plain or as an escape sequence through resolveEscapeSequence().
+ *      stdin is replaced with a pipe that's kept topped up with a mix of
+ *      the sequences terminals send (vt100, rxvt, linux console and
+ *      xterm with modifiers), so the reads are real system calls, just
+ *      without anyone typing.  Decode is the trie walk on its own.
+ *
+ *      Before timing anything it checks that every sequence decodes, and
+ *      that ones the table doesn't have (Home, Delete...) leave nothing
+ *      behind to be typed, while Alt-x leaves its x.
+ *
+ *      Usage: build/bench_keyboard [iterations]
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "../include/rkeyboard.h"
+#include "bench.h"
+
+using namespace std;
+
+// what a pipe-full of keys is made of
+const vector<string> sequences = {
+   "\x1BOA", "\x1B[B", "\x1B[C", "\x1BOD", "\x1B[[A", "\x1B[17~",
+   "\x1B[1;5C", "\x1B[1;2A", "\x1B[21;3~", "\x1BOM"
+};
+
+/**
+ * @function refill
+ * Writes a batch of keys into the pipe standing in for the keyboard.
+ * @returns {size_t} how many keys were written.
+ */
+size_t refill(int pipeEnd, const string& batch, size_t keys) {
+   size_t written = 0;
+   while (written < batch.length()) {
+      ssize_t result = write(pipeEnd, batch.data() + written, batch.length() - written);
+      if (result <= 0) {
+         break;
+      }
+      written += result;
+   }
+   return keys;
+}
+
+int main(int argc, char** argv) {
+   size_t iterations = (argc > 1) ? stoul(argv[1]) : 200000;
+
+   int keys[2];
+   if (pipe(keys) < 0 || dup2(keys[0], STDIN_FILENO) < 0) {
+      cerr << "no pipe" << endl;
+      return 1;
+   }
+   rkeyboard keyboard;
+
+   // a few hundred keys at a time, well inside the pipe and the ring buffer
+   const size_t batchKeys = 256;
+   string escapes;
+   for (size_t i = 0; i < batchKeys; i++) {
+      escapes += sequences[i % sequences.size()];
+   }
+   string letters(batchKeys, 'a');
+
+   // make sure every sequence decodes before timing anything
+   refill(keys[1], escapes, batchKeys);
+   for (size_t i = 0; i < batchKeys; i++) {
+      if (keyboard.getch() != 0x1B || resolveEscapeSequence() < 0) {
+         cerr << "sequence " << i % sequences.size() << " didn't decode" << endl;
+         return 1;
+      }
+   }
+
+   // keys that aren't in the table are swallowed whole, but Alt-x's x
+   // is given back to be typed
+   const vector<pair<string, string>> unknown = {
+      {"\x1B[3~", ""}, {"\x1B[H", ""}, {"\x1B[5;3~", ""}, {"\x1B[Z", ""},
+      {"\x1BOH", ""}, {"\x1B[[Z", ""}, {"\x1Bx", "x"}, {"\x1B\x1B", "\x1B"}
+   };
+   for (const auto& sequence : unknown) {
+      refill(keys[1], sequence.first, 1);
+      string given;
+      if (keyboard.getch() != 0x1B || resolveEscapeSequence() != -1) {
+         cerr << "unknown sequence " << sequence.first.substr(1) << " decoded" << endl;
+         return 1;
+      }
+      while (keyboard.available() > 0) {
+         given += (char) keyboard.getch();
+      }
+      if (given != sequence.second) {
+         cerr << "unknown sequence " << sequence.first.substr(1) << " left \"" << given << "\"" << endl;
+         return 1;
+      }
+   }
+
+   size_t left = 0;
+   benchPrint("Keyboard/getch", benchMeasure(iterations, [&](size_t) {
+      if (left == 0) {
+         left = refill(keys[1], letters, batchKeys);
+      }
+      left--;
+      benchSink += keyboard.getch();
+   }));
+
+   left = 0;
+   benchPrint("Keyboard/resolveEscapeSequence", benchMeasure(iterations, [&](size_t) {
+      if (left == 0) {
+         left = refill(keys[1], escapes, batchKeys);
+      }
+      left--;
+      keyboard.getch();
+      benchSink += resolveEscapeSequence();
+   }));
+
+   benchPrint("Keyboard/decode", benchMeasure(iterations, [&](size_t i) {
+      const string& sequence = sequences[i % sequences.size()];
+      rescapeDecoder decoder;
+      int key = rescapeDecoder::pending;
+      for (size_t j = 0; j < sequence.length() && key == rescapeDecoder::pending; j++) {
+         key = decoder.feed(sequence[j]);
+      }
+      benchSink += key;
+   }));
+
+   return 0;
+}
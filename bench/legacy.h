@@ -0,0 +1,102 @@
+/*
+ * Legacy implementations
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ *
+ * Description:
+ *
+ *      Verbatim copies of code that has since been replaced, kept only so
+ *      the benchmarks have something to compare against.
+ */
+
+#ifndef BENCH_LEGACY_H
+#define BENCH_LEGACY_H
+
+#include <stack>
+#include <string>
+
+using namespace std;
+
+/**
+ * @function legacyProcessUnescapedSequence
+ * What rterm::processUnescapedSequence() used to be.
+ */
+string legacyProcessUnescapedSequence(const string originalSequence, const int param1, const int param2) {
+   string swap = originalSequence;
+   int nParam1 = param1;
+   int nParam2 = param2;
+   
+   // Check for flag to increment numeric parameters by 1.
+   size_t i = swap.find("%i");
+   if (i != string::npos) {
+      swap.erase(i,2);
+      nParam1 += 1;
+      nParam2 += 1;
+   }
+   
+   // Filter through parameters and printing them
+   stack<int> pStack;
+   size_t nextP = swap.find("%p");
+   size_t nextD = swap.find("%d");
+   while ((nextP != string::npos) || (nextD != string::npos)) {
+      if (nextP < nextD) {
+         if (swap[nextP + 2] == '1') {
+            pStack.push(nParam1);
+         } else {
+            pStack.push(nParam2);
+         }
+         swap.erase(nextP, 3);
+      } else {
+         swap.replace(nextD, 2, to_string(pStack.top()));
+         pStack.pop();
+      }
+      
+      nextP = swap.find("%p");
+      nextD = swap.find("%d");
+   }
+   return swap;
+}
+
+/**
+ * @function legacyLength_utf8
+ * What temporary_utf8.h's length_utf8() used to be.
+ */
+size_t legacyLength_utf8(const string& str) {
+   size_t c,i,ix,q;
+   for (q=0, i=0, ix=str.length(); i < ix; i++, q++) {
+      c = (unsigned char) str[i];
+      if      (c<=127) i+=0;
+      else if ((c & 0xE0) == 0xC0) i+=1;
+      else if ((c & 0xF0) == 0xE0) i+=2;
+      else if ((c & 0xF8) == 0xF0) i+=3;
+      else return -1;//invalid utf8
+   }
+   return q;
+}
+
+/**
+ * @function legacySubstr_utf8
+ * What temporary_utf8.h's substr_utf8() used to be.
+ */
+string legacySubstr_utf8(const string& str, size_t start, size_t leng)
+{
+    if (leng==0) { return ""; }
+    size_t c, i, ix, q, min=string::npos, max=string::npos;
+    for (q=0, i=0, ix=str.length(); i < ix; i++, q++)
+    {
+        if (q==start){ min=i; }
+        if (q<=start+leng || leng==string::npos){ max=i; }
+
+        c = (unsigned char) str[i];
+        if      (c<=127) i+=0;
+        else if ((c & 0xE0) == 0xC0) i+=1;
+        else if ((c & 0xF0) == 0xE0) i+=2;
+        else if ((c & 0xF8) == 0xF0) i+=3;
+        else return "";//invalid utf8
+    }
+    if (q<=start+leng || leng==string::npos){ max=i; }
+    if (min==string::npos || max==string::npos) { return ""; }
+    return str.substr(min, max - min);
+}
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * Benchmark: parm
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ *
+ * Description:
+ *
+ *      Nanoseconds (and allocations) per cursor-addressing call: the old
+ *      string-rewriting processUnescapedSequence() against a compiled rparm.
+ *
+ *      Usage: build/bench_parm [iterations]
+ */
+
+#include <iostream>
+#include <string>
+
+#include "../include/rparm.h"
+#include "bench.h"
+#include "legacy.h"
+
+using namespace std;
+
+int main(int argc, char** argv) {
+   size_t iterations = (argc > 1) ? stoul(argv[1]) : 1000000;
+   const string cup = "\x1B[%i%p1%d;%p2%dH";
+
+   // make sure both agree before timing anything
+   rparm compiled(cup);
+   char buffer[32];
+   for (int line = 0; line < 50; line++) {
+      for (int col = 0; col < 200; col += 7) {
+         compiled.format(buffer, sizeof buffer, line, col);
+         if (legacyProcessUnescapedSequence(cup, line, col) != buffer) {
+            cerr << "mismatch at " << line << "," << col << endl;
+            return 1;
+         }
+      }
+   }
+
+   benchPrint("Parm/cup/processUnescapedSequence", benchMeasure(iterations, [&](size_t i) {
+      benchSink += legacyProcessUnescapedSequence(cup, i % 48, i % 160).length();
+   }));
+   benchPrint("Parm/cup/rparm", benchMeasure(iterations, [&](size_t i) {
+      benchSink += compiled.format(buffer, sizeof buffer, i % 48, i % 160);
+   }));
+
+   return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * Benchmark: redraw
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ *
+ * Description:
+ *
+ *      FileBrowser drawing into an 80x24 xterm-style rscreen, over 1k and
+ *      100k synthetic file names, and how many bytes each frame sends to
+ *      the terminal (which goes to /dev/null here):
+ *
+ *          full       redrawTable() after the terminal was forgotten
+ *          unchanged  redrawTable() with nothing to change
+ *          select     moving the selection within a page
+ *          page       moving to a different page
+ *          layout     a new list: measuring every name, then a page
+ *
+ *      Usage: build/bench_redraw [iterations]
+ */
+
+#include <iostream>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/menu/FileBrowser.h"
+#include "bench.h"
+
+using namespace std;
+
+/**
+ * @function makeItems
+ * Names like a recordings directory plus some odds and ends, sorted the
+ * way menu sorts them (well enough).
+ */
+void makeItems(ritems& items, size_t count) {
+   const char* stems[] = {
+      "recording-%06zu.mid", "Notes %zu.txt", "build_%zu.sh", "résumé-%zu.pdf",
+      "日本語-%zu.txt", "a rather long file name, number %zu.txt"
+   };
+   char name[128];
+   for (size_t i = 0; i < count; i++) {
+      size_t stem = i % (sizeof stems / sizeof stems[0]);
+      snprintf(name, sizeof name, stems[stem], i);
+      items.push_back(name, (stem == 2) ? RI_EXECUTABLE : RI_NONE);
+   }
+}
+
+int main(int argc, char** argv) {
+   size_t iterations = (argc > 1) ? stoul(argv[1]) : 2000;
+
+   // the same terminal every run, whatever this one is
+   setenv("TERM", "xterm", 1);
+   setenv("COLUMNS", "80", 1);
+   setenv("LINES", "24", 1);
+   benchQuiet();
+
+   rterm rt;
+   rscreen screen(&rt);
+
+   for (size_t count : {(size_t) 1000, (size_t) 100000}) {
+      string size = to_string(count / 1000) + "k";
+      ritems items;
+      makeItems(items, count);
+      FileBrowser fb(&screen, &items);
+      screen.present();
+
+      // bytes sent per op while timing
+      size_t before;
+      auto bytesPerFrame = [&](const benchResult& result) {
+         return (double) (rt.totals.bytes - before) / (result.iterations + 1);
+      };
+
+      before = rt.totals.bytes;
+      benchResult result = benchMeasure(iterations, [&](size_t) {
+         screen.invalidate();
+         fb.redrawTable();
+      });
+      benchPrint("RedrawTable/" + size + "/full", result, bytesPerFrame(result));
+
+      before = rt.totals.bytes;
+      result = benchMeasure(iterations, [&](size_t) {
+         fb.redrawTable();
+      });
+      benchPrint("RedrawTable/" + size + "/unchanged", result, bytesPerFrame(result));
+
+      before = rt.totals.bytes;
+      result = benchMeasure(iterations, [&](size_t i) {
+         if (i % 2) {
+            fb.pressedLeft();
+         } else {
+            fb.pressedRight();
+         }
+      });
+      benchPrint("RedrawTable/" + size + "/select", result, bytesPerFrame(result));
+
+      // far enough each time to land on another page (there are well
+      // under 251 items on one), so its labels are never already made
+      before = rt.totals.bytes;
+      result = benchMeasure(iterations, [&](size_t i) {
+         fb.setIndex(((i + 1) * 251) % count);
+      });
+      benchPrint("RedrawTable/" + size + "/page", result, bytesPerFrame(result));
+
+      before = rt.totals.bytes;
+      result = benchMeasure(iterations / 10 + 1, [&](size_t) {
+         fb.setItems(&items);
+         fb.redrawTable();
+      });
+      benchPrint("RedrawTable/" + size + "/layout", result, bytesPerFrame(result));
+   }
+
+   return 0;
+}
@@ -0,0 +1,127 @@
+/*
+ * Benchmark: scan
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ *
+ * Description:
+ *
+ *      Listing a directory of 1k and 10k files (a tenth of them
+ *      executable, plus a few subdirectories) made under /tmp: rscan as
+ *      menu uses it, against the directory_iterator + is_regular_file() +
+ *      status() loop it replaced.  The directory is in the page cache
+ *      after the first pass, so this is the CPU and system call cost, not
+ *      the SD card's.
+ *
+ *      Usage: build/bench_scan [iterations]
+ */
+
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../include/ritems.h"
+#include "../include/rscan.h"
+#include "bench.h"
+
+using namespace std;
+
+/**
+ * @function makeDirectory
+ * @returns {string} a new directory under /tmp with count files in it.
+ */
+string makeDirectory(size_t count) {
+   char path[] = "/tmp/bench_scan.XXXXXX";
+   if (!mkdtemp(path)) {
+      return "";
+   }
+   for (size_t i = 0; i < count; i++) {
+      string name = string(path) + "/file-" + to_string(i) + ((i % 10 == 0) ? ".sh" : ".txt");
+      int fd = open(name.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, (i % 10 == 0) ? 0755 : 0644);
+      if (fd >= 0) {
+         close(fd);
+      }
+   }
+   for (size_t i = 0; i < 8; i++) {
+      mkdir((string(path) + "/folder-" + to_string(i)).c_str(), 0755);
+   }
+   return path;
+}
+
+/**
+ * @function legacyList
+ * What menu did before rscan.
+ */
+size_t legacyList(const string& path) {
+   vector<string> files;
+   vector<string> apps;
+   for (const auto& entry : filesystem::directory_iterator(path)) {
+      if (filesystem::is_regular_file(entry)) {
+         if ((filesystem::status(entry).permissions() & filesystem::perms::others_exec) != filesystem::perms::none) {
+            apps.push_back(entry.path().filename());
+         } else {
+            files.push_back(entry.path().filename());
+         }
+      }
+   }
+   return files.size() + apps.size();
+}
+
+/**
+ * @function scanList
+ * A whole rscan, the way menu's onScan collects it.
+ */
+size_t scanList(rscan& scanner, const string& path) {
+   ritems items;
+   if (!scanner.start(path)) {
+      return 0;
+   }
+   while (true) {
+      struct pollfd ready = {scanner.fd(), POLLIN, 0};
+      poll(&ready, 1, -1);
+      scanner.collect(items);
+      if (scanner.done()) {
+         break;
+      }
+   }
+   scanner.stop();
+   return items.size();
+}
+
+int main(int argc, char** argv) {
+   size_t iterations = (argc > 1) ? stoul(argv[1]) : 100;
+
+   for (size_t count : {(size_t) 1000, (size_t) 10000}) {
+      string size = to_string(count / 1000) + "k";
+      string path = makeDirectory(count);
+      if (path.empty()) {
+         cerr << "couldn't make a directory under /tmp" << endl;
+         return 1;
+      }
+      size_t runs = (count > 1000) ? iterations / 10 + 1 : iterations;
+
+      rscan scanner;
+      scanner.directories = true;
+      if (scanList(scanner, path) != count + 8 || legacyList(path) != count) {
+         cerr << "listings don't match" << endl;
+         filesystem::remove_all(path);
+         return 1;
+      }
+
+      benchPrint("Scan/" + size + "/directory_iterator", benchMeasure(runs, [&](size_t) {
+         benchSink += legacyList(path);
+      }));
+      benchPrint("Scan/" + size + "/rscan", benchMeasure(runs, [&](size_t) {
+         benchSink += scanList(scanner, path);
+      }));
+
+      filesystem::remove_all(path);
+   }
+
+   return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * Benchmark: spawn
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ *
+ * Description:
+ *
+ *      Compares starting a child with fork() + execlp() (how menu and midi
+ *      used to) against rspawn's posix_spawn(), from a parent whose size
+ *      can be chosen to show the page table copy fork() makes.  A busy
+ *      thread keeps running throughout, like rscan's workers.
+ *
+ *      "start" is how long the parent is held up before it can carry on;
+ *      "roundtrip" also waits for the child (true) to exit.
+ *
+ *      Not part of `make bench`: it's slow, and what it shows depends on
+ *      the parent size chosen.
+ *
+ *      Usage: build/bench_spawn [iterations] [parent MB]
+ */
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../include/rspawn.h"
+#include "bench.h"
+
+using namespace std;
+
+/**
+ * @function forkExec
+ * What menu's launch() used to do.
+ */
+pid_t forkExec() {
+   pid_t pid = fork();
+   if (pid == 0) {
+      execlp("true", "true", NULL);
+      _exit(127);
+   }
+   return pid;
+}
+
+/**
+ * @function measure
+ * Starts and reaps the child a number of times.
+ * @param {benchResult&} roundTrip - gets the time per start and wait.
+ * @returns {benchResult} the time per start alone.
+ */
+template<typename Start>
+benchResult measure(Start start, size_t iterations, benchResult& roundTrip) {
+   double startNs = 0;
+   size_t allocations = benchAllocations.load();
+   auto begin = chrono::steady_clock::now();
+   for (size_t i = 0; i < iterations; i++) {
+      auto before = chrono::steady_clock::now();
+      pid_t pid = start();
+      startNs += chrono::duration<double, nano>(chrono::steady_clock::now() - before).count();
+      if (pid > 0) {
+         int status;
+         waitpid(pid, &status, 0);
+      }
+   }
+   double perOp = (double) (benchAllocations.load() - allocations) / iterations;
+   roundTrip = {iterations, chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count() / iterations, perOp};
+   return {iterations, startNs / iterations, perOp};
+}
+
+int main(int argc, char** argv) {
+   size_t iterations = (argc > 1) ? stoul(argv[1]) : 200;
+   size_t megabytes = (argc > 2) ? stoul(argv[2]) : 256;
+
+   // a parent with this much memory actually in use
+   vector<char> ballast(megabytes << 20);
+   for (size_t i = 0; i < ballast.size(); i += 4096) {
+      ballast[i] = 1;
+   }
+
+   atomic<bool> stopping(false);
+   thread busy([&stopping]() {
+      while (!stopping) {
+         this_thread::yield();
+      }
+   });
+
+   rspawn launcher;
+   benchResult forkTrip, spawnTrip;
+   benchResult forkStart = measure(forkExec, iterations, forkTrip);
+   benchResult spawnStart = measure([&launcher]() { return launcher.start({"true"}); }, iterations, spawnTrip);
+
+   stopping = true;
+   busy.join();
+
+   string parent = "Spawn/" + to_string(megabytes) + "MB/";
+   benchPrint(parent + "fork/start", forkStart);
+   benchPrint(parent + "fork/roundtrip", forkTrip);
+   benchPrint(parent + "posix_spawn/start", spawnStart);
+   benchPrint(parent + "posix_spawn/roundtrip", spawnTrip);
+   return 0;
+}
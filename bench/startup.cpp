@@ -0,0 +1,54 @@
+/*
+ * Benchmark: startup
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ *
+ * Description:
+ *
+ *      Compares the time rterm takes to get going when it reads terminfo
+ *      itself against the old way of asking tput for every capability.
+ *
+ *      Usage: build/bench_startup [iterations]
+ */
+
+#include <string>
+
+#include "../include/rterm.h"
+#include "bench.h"
+
+using namespace std;
+
+/**
+ * @function startupWithTput
+ * What rterm::rterm() used to do: eight capabilities plus two dimensions,
+ * each one its own tput process.
+ */
+void startupWithTput(rterm& rt) {
+   // (reset complains on stderr when there's no terminal to reset)
+   const char* commands[] = {
+      "tput clear", "tput cup", "tput rev", "tput sgr0", "tput sc",
+      "tput rc", "tput csr", "tput reset 2>/dev/null", "tput cols", "tput lines"
+   };
+   for (auto command : commands) {
+      rt.exec(command);
+   }
+}
+
+int main(int argc, char** argv) {
+   size_t iterations = (argc > 1) ? stoul(argv[1]) : 20;
+
+   rterm rt;
+
+   // a configuration line, which benchstat keeps with the results
+   fprintf(benchReport, "terminal: %s%s\n", rt.info.name.c_str(), rt.info.builtin ? " (built-in table)" : "");
+
+   benchPrint("Startup/tput", benchMeasure(iterations, [&](size_t) {
+      startupWithTput(rt);
+   }));
+   benchPrint("Startup/terminfo", benchMeasure(iterations, [&](size_t) {
+      rterm fresh;
+      benchSink += fresh.cols;
+   }));
+
+   return 0;
+}
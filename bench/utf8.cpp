@@ -0,0 +1,118 @@
+/*
+ * Benchmark: utf8
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ *
+ * Description:
+ *
+ *      rutf8.h against the byte-at-a-time temporary_utf8.h it replaced, on
+ *      a directory's worth of filename-sized strings and on a megabyte of
+ *      text, both plain ASCII and mixed with accented and CJK characters.
+ *
+ *      Usage: build/bench_utf8 [iterations]
+ */
+
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../include/rutf8.h"
+#include "bench.h"
+#include "legacy.h"
+
+using namespace std;
+
+/**
+ * @function makeNames
+ * A mix of names like a home directory has: mostly ASCII, some accented,
+ * some CJK, a couple of emoji.
+ */
+vector<string> makeNames(size_t count) {
+   const char* stems[] = {
+      "notes.txt", "README.md", "build.sh", "Makefile", "screenshot-2021-04-02.png",
+      "résumé.pdf", "naïve café menu.txt", "日本語のファイル.txt", "音乐.mid", "🎹 track 01.mid",
+      "a very long file name that goes on and on.txt", "Ελληνικά.doc"
+   };
+   vector<string> names;
+   for (size_t i = 0; i < count; i++) {
+      names.push_back(to_string(i) + "_" + stems[i % (sizeof stems / sizeof stems[0])]);
+   }
+   return names;
+}
+
+/**
+ * @function makeText
+ * About a megabyte made by repeating a sample.
+ */
+string makeText(const string& sample) {
+   string text;
+   while (text.length() < (1 << 20)) {
+      text += sample;
+   }
+   return text;
+}
+
+/**
+ * @function timeIt
+ * @returns {benchResult} time and allocations per call of work, over all
+ * the inputs.
+ */
+benchResult timeIt(size_t iterations, const vector<string>& inputs, function<size_t(const string&)> work) {
+   benchResult result = benchMeasure(iterations, [&](size_t) {
+      for (const auto& input : inputs) {
+         benchSink += work(input);
+      }
+   });
+   result.iterations *= inputs.size();
+   result.nanoseconds /= inputs.size();
+   result.allocations /= inputs.size();
+   return result;
+}
+
+int main(int argc, char** argv) {
+   size_t iterations = (argc > 1) ? stoul(argv[1]) : 200;
+
+   struct {
+      const char* name;
+      vector<string> inputs;
+      size_t iterations;
+   } sets[] = {
+      {"filenames", makeNames(1000), iterations},
+      {"1MB-ascii", {makeText("The quick brown fox jumps over the lazy dog. ")}, iterations / 20 + 1},
+      {"1MB-mixed", {makeText("Naïve café — 日本語のテキスト, Ελληνικά, and ASCII. ")}, iterations / 20 + 1}
+   };
+
+   // make sure old and new agree before timing anything
+   for (auto& set : sets) {
+      for (const auto& input : set.inputs) {
+         size_t count = legacyLength_utf8(input);
+         if (length_utf8(input) != count || !valid_utf8(input)
+               || substr_utf8(input, count / 3, count / 2) != legacySubstr_utf8(input, count / 3, count / 2)) {
+            cerr << "mismatch in " << set.name << endl;
+            return 1;
+         }
+      }
+   }
+
+   for (auto& set : sets) {
+      struct {
+         const char* name;
+         function<size_t(const string&)> work;
+      } cases[] = {
+         {"length/legacy", [](const string& s) { return legacyLength_utf8(s); }},
+         {"length/rutf8", [](const string& s) { return length_utf8(s); }},
+         {"valid/rutf8", [](const string& s) { return (size_t) valid_utf8(s); }},
+         {"width/rutf8", [](const string& s) { return width_utf8(s); }},
+         {"substr/legacy", [](const string& s) { return legacySubstr_utf8(s, 0, 24).length(); }},
+         {"substr/rutf8", [](const string& s) { return substr_utf8(s, 0, 24).length(); }},
+         {"truncate/rutf8", [](const string& s) { return truncate_utf8(s, 24).length(); }}
+      };
+
+      for (auto& c : cases) {
+         benchPrint(string("Utf8/") + set.name + "/" + c.name, timeIt(set.iterations, set.inputs, c.work));
+      }
+   }
+
+   return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * Class: rdircache
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ * Author: Renee Waverly Sonntag
+ *
+ * Description:
+ *
+ *      Remembers the last few directories a browser has shown, so going
+ *      back to one doesn't mean reading, stat()ing and sorting it again.
+ *      Each snapshot is the sorted list itself plus its widest name (all
+ *      the layout needs) and which name was selected.
+ *
+ *      Snapshots are keyed by the directory's device and inode, and are
+ *      only handed back while its mtime is unchanged: creating, removing
+ *      or renaming anything in a directory updates its mtime, so a stale
+ *      list is never shown.  The selection outlives a stale list, so the
+ *      cursor still comes back to the same name after a rescan.
+ *
+ *      Lists are swapped in and out rather than copied.  When full, the
+ *      least recently used directory is forgotten.
+ */
+
+#ifndef RDIRCACHE_H
+#define RDIRCACHE_H
+
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "ritems.h"
+
+using namespace std;
+
+class rdircache {
+   private:
+      struct entry {
+         dev_t device;
+         ino_t inode;
+         struct timespec modified;
+         bool complete;        // false if only the selection is known
+         ritems items;
+         size_t widest;
+         string selected;
+         unsigned long used;
+      };
+
+      vector<entry> entries;
+      size_t capacity;
+      unsigned long clock;
+
+      entry* lookup(const struct stat&);
+
+   public:
+      rdircache(const size_t = 8);
+
+      void put(const struct stat&, ritems&, const size_t, const string&, const bool = true);
+      bool take(const struct stat&, ritems&, size_t&, string&);
+      void clear();
+};
+
+/**
+ * @constructs rdircache
+ * @param {const size_t} newcapacity - how many directories to remember.
+ */
+rdircache::rdircache(const size_t newcapacity) {
+   capacity = (newcapacity > 0) ? newcapacity : 1;
+   clock = 0;
+}
+
+/**
+ * @private
+ * @method lookup
+ * @returns {entry*} the entry for the directory (whatever its mtime), or
+ * NULL if there isn't one.
+ */
+rdircache::entry* rdircache::lookup(const struct stat& info) {
+   for (auto& e : entries) {
+      if (e.device == info.st_dev && e.inode == info.st_ino) {
+         return &e;
+      }
+   }
+   return NULL;
+}
+
+/**
+ * @method put
+ * Stores a directory's list when leaving it.  The list is swapped into
+ * the cache, leaving whatever was cached before (or nothing) behind.
+ * @param {const struct stat&} info - the directory's stat() from before it
+ * was read, so anything changed since makes the snapshot stale.
+ * @param {ritems&} items - its sorted list.
+ * @param {const size_t} widest - the widest item's display width.
+ * @param {const string&} selected - the name that was selected.
+ * @param {const bool} complete - false if the list is unfinished (e.g. a
+ * scan was cut short) and only the selection should be kept.
+ */
+void rdircache::put(const struct stat& info, ritems& items, const size_t widest, const string& selected, const bool complete) {
+   entry* e = lookup(info);
+   if (!e) {
+      if (entries.size() < capacity) {
+         entries.emplace_back();
+         e = &entries.back();
+      } else {
+         // forget the least recently used
+         e = &entries[0];
+         for (auto& candidate : entries) {
+            if (candidate.used < e->used) {
+               e = &candidate;
+            }
+         }
+      }
+      e->device = info.st_dev;
+      e->inode = info.st_ino;
+   }
+
+   e->modified = info.st_mtim;
+   e->complete = complete;
+   e->items.clear();
+   if (complete) {
+      e->items.swap(items);
+   } else {
+      e->items.shrink_to_fit();
+   }
+   e->widest = widest;
+   e->selected = selected;
+   e->used = ++clock;
+}
+
+/**
+ * @method take
+ * Gets a directory's list back when entering it, if it's still current.
+ * @param {const struct stat&} info - the directory's stat().
+ * @param {ritems&} items - gets the list (swapped out of the cache).
+ * @param {size_t&} widest - gets the widest item's display width.
+ * @param {string&} selected - gets the name that was selected, if the
+ * directory was seen before at all (even if the list is stale).
+ * @returns {bool} true if items was filled in.
+ */
+bool rdircache::take(const struct stat& info, ritems& items, size_t& widest, string& selected) {
+   entry* e = lookup(info);
+   if (!e) {
+      selected.clear();
+      return false;
+   }
+   selected = e->selected;
+   e->used = ++clock;
+
+   bool current = e->complete && e->modified.tv_sec == info.st_mtim.tv_sec
+      && e->modified.tv_nsec == info.st_mtim.tv_nsec;
+   if (!current) {
+      e->items.clear();
+      e->items.shrink_to_fit();
+      e->complete = false;
+      return false;
+   }
+
+   items.swap(e->items);
+   e->items.clear();
+   widest = e->widest;
+   e->complete = false;
+   return true;
+}
+
+/**
+ * @method clear
+ * Forgets everything.
+ */
+void rdircache::clear() {
+   entries.clear();
+}
+
+#endif
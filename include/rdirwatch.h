@@ -0,0 +1,186 @@
+/*
+ * Class: rdirwatch
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ * Author: Renee Waverly Sonntag
+ *
+ * Description:
+ *
+ *      Tells a program which names in a directory were created, deleted,
+ *      renamed or had their permissions changed, through inotify, so a
+ *      listing can be patched a name at a time instead of being read
+ *      again.  The descriptor can sit in an rloop; a whole batch of events
+ *      comes in with one read().
+ *
+ *      If the kernel's queue overflows, events were lost and the listing
+ *      has to be read again; next() reports that as an event with
+ *      overflowed set.
+ */
+
+#ifndef RDIRWATCH_H
+#define RDIRWATCH_H
+
+#include <string>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+using namespace std;
+
+/*
+ * One change.  name is the entry that changed (empty on overflow).
+ */
+struct rdirEvent {
+   string name;
+   uint32_t mask;
+   bool overflowed;
+};
+
+class rdirwatch {
+   private:
+      static constexpr uint32_t interesting = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+         | IN_ATTRIB | IN_ONLYDIR;
+
+      int descriptor;
+      int watchId;
+
+      // room for plenty of events with long names
+      alignas(struct inotify_event) char batch[16384];
+      size_t batchHead;
+      size_t batchTail;
+
+   public:
+      rdirwatch();
+      ~rdirwatch();
+
+      bool watch(const string&);
+      void unwatch();
+
+      int fd() const;
+      size_t fill();
+      bool next(rdirEvent&);
+};
+
+/**
+ * @constructs rdirwatch
+ * Nothing is watched until watch().
+ */
+rdirwatch::rdirwatch() {
+   descriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+   watchId = -1;
+   batchHead = 0;
+   batchTail = 0;
+}
+
+/**
+ * @destructs rdirwatch
+ */
+rdirwatch::~rdirwatch() {
+   if (descriptor >= 0) {
+      close(descriptor);
+   }
+}
+
+/**
+ * @method watch
+ * Starts watching a directory, instead of any watched before.
+ * @param {const string&} path - the directory.
+ * @returns {bool} false if it can't be watched (e.g. no inotify).
+ */
+bool rdirwatch::watch(const string& path) {
+   unwatch();
+   if (descriptor < 0) {
+      return false;
+   }
+   watchId = inotify_add_watch(descriptor, path.c_str(), interesting);
+   return watchId >= 0;
+}
+
+/**
+ * @method unwatch
+ * Stops watching, and drops any events not yet taken.
+ */
+void rdirwatch::unwatch() {
+   if (watchId >= 0) {
+      inotify_rm_watch(descriptor, watchId);
+      watchId = -1;
+   }
+   batchHead = 0;
+   batchTail = 0;
+}
+
+/**
+ * @method fd
+ * @returns {int} the descriptor to poll, -1 if inotify isn't available.
+ */
+int rdirwatch::fd() const {
+   return descriptor;
+}
+
+/**
+ * @method fill
+ * Reads whatever events are ready with one read().  Doesn't block.
+ * @returns {size_t} the number of bytes read.
+ */
+size_t rdirwatch::fill() {
+   if (descriptor < 0) {
+      return 0;
+   }
+   if (batchHead == batchTail) {
+      batchHead = 0;
+      batchTail = 0;
+   }
+   if (batchTail > 0) {
+      // events are only ever read whole, so this is rare
+      memmove(batch, batch + batchHead, batchTail - batchHead);
+      batchTail -= batchHead;
+      batchHead = 0;
+   }
+
+   ssize_t result;
+   do {
+      result = read(descriptor, batch + batchTail, sizeof batch - batchTail);
+   } while (result < 0 && errno == EINTR);
+   if (result <= 0) {
+      return 0;
+   }
+   batchTail += result;
+   return result;
+}
+
+/**
+ * @method next
+ * Takes the next event for the watched directory.  Events left over from
+ * a directory watched before are skipped.
+ * @param {rdirEvent&} event - filled in with the event.
+ * @returns {bool} false if none is buffered.
+ */
+bool rdirwatch::next(rdirEvent& event) {
+   while (batchTail - batchHead >= sizeof(struct inotify_event)) {
+      const struct inotify_event* raw = (const struct inotify_event*) (batch + batchHead);
+      size_t size = sizeof(struct inotify_event) + raw->len;
+      if (batchTail - batchHead < size) {
+         break;
+      }
+      batchHead += size;
+
+      if (raw->mask & IN_Q_OVERFLOW) {
+         event.name.clear();
+         event.mask = raw->mask;
+         event.overflowed = true;
+         return true;
+      }
+      if (raw->wd != watchId || raw->len == 0) {
+         continue;
+      }
+      event.name.assign(raw->name, strnlen(raw->name, raw->len));
+      event.mask = raw->mask;
+      event.overflowed = false;
+      return true;
+   }
+   return false;
+}
+
+#endif
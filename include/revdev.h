@@ -0,0 +1,379 @@
+/*
+ * Class: revdev
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ * Author: Renee Waverly Sonntag
+ *
+ * Description:
+ *
+ *      Reads the TRS-80 keyboard straight from its evdev node instead of
+ *      through the tty.  scripts/keyboard/keyboard.py publishes a uinput
+ *      device (vendor 0x08B9, product 0x3802); the tty layer turns its keys
+ *      into VT escape strings that resolveEscapeSequence() then has to take
+ *      apart again.  Here every key arrives as one fixed-size input_event
+ *      with its own press/release/repeat value and kernel timestamp, and a
+ *      whole batch of them comes in with a single read().  The node isn't
+ *      grabbed, so the console still gets the keys too (midi uses it only
+ *      when run with TRS80_KEYBOARD=evdev).
+ *
+ *      Anything that reads input_events can be fed a recording instead of a
+ *      device, so key handling can be replayed without the hardware:
+ *
+ *          cat /dev/input/by-id/...-event-kbd > keys.bin   (then ^C)
+ *          TRS80_KEYBOARD_REPLAY=keys.bin build/midi
+ *
+ *      <linux/input.h> isn't included because its KEY_ names clash with the
+ *      ones in rkeyboard.h; the few definitions needed are repeated below.
+ */
+
+#ifndef REVDEV_H
+#define REVDEV_H
+
+#include <string>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "rkeyboard.h"
+
+using namespace std;
+
+// Radio Shack's USB vendor id and the Model 100's catalog number,
+// as set in keyboard.py
+#define REVDEV_VENDOR 0x08B9
+#define REVDEV_PRODUCT 0x3802
+
+// press, release and autorepeat, as in input_event.value
+#define REVDEV_RELEASE 0
+#define REVDEV_PRESS 1
+#define REVDEV_REPEAT 2
+
+/*
+ * One key event.  key is the matching rkeyboard KEY_ index (with
+ * KEY_MOD_ bits for held modifiers) or -1 if it has none; code is the
+ * kernel's key code either way.
+ */
+struct rkeyEvent {
+   struct timeval time;
+   uint16_t code;
+   int value;
+   int key;
+};
+
+class revdev {
+   private:
+      // struct input_event and struct input_id from <linux/input.h>;
+      // the kernel's timestamp is two longs, which isn't a timeval
+      // where time_t is 64 bits on a 32-bit machine (armhf)
+      struct rawEvent {
+         unsigned long sec;
+         unsigned long usec;
+         uint16_t type;
+         uint16_t code;
+         int32_t value;
+      };
+      struct rawId {
+         uint16_t bustype;
+         uint16_t vendor;
+         uint16_t product;
+         uint16_t version;
+      };
+
+      static constexpr unsigned long ioctlGetId = _IOR('E', 0x02, struct rawId);
+      static constexpr unsigned long ioctlGrab = _IOW('E', 0x90, int);
+      static constexpr uint16_t eventKey = 0x01;
+      static constexpr size_t batchSize = 64;
+
+      int descriptor;
+      bool replaying;
+      bool ended;
+
+      rawEvent batch[batchSize];
+      size_t batchHead;
+      size_t batchTail;
+
+      int modifiers;
+
+      bool openPath(const string&);
+      int translate(const uint16_t, const int);
+
+   public:
+      string path;
+
+      revdev();
+      ~revdev();
+
+      bool open(const uint16_t = REVDEV_VENDOR, const uint16_t = REVDEV_PRODUCT);
+      bool replay(const string&);
+      void close();
+      bool grab(const bool);
+
+      int fd() const;
+      bool isReplay() const;
+      bool finished() const;
+      size_t fill();
+      bool next(rkeyEvent&);
+};
+
+/**
+ * @constructs revdev
+ * Nothing is opened until open() or replay().
+ */
+revdev::revdev() {
+   descriptor = -1;
+   replaying = false;
+   ended = false;
+   batchHead = 0;
+   batchTail = 0;
+   modifiers = 0;
+}
+
+/**
+ * @destructs revdev
+ */
+revdev::~revdev() {
+   close();
+}
+
+/**
+ * @private
+ * @method openPath
+ * Opens a device node or recording, non-blocking.
+ */
+bool revdev::openPath(const string& newPath) {
+   close();
+   descriptor = ::open(newPath.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+   if (descriptor < 0) {
+      return false;
+   }
+   path = newPath;
+   return true;
+}
+
+/**
+ * @method open
+ * Finds the event node whose ids match and opens it.  If
+ * TRS80_KEYBOARD_REPLAY names a file, that recording is replayed instead.
+ * @param {const uint16_t} vendor - the USB vendor id to look for.
+ * @param {const uint16_t} product - the USB product id to look for.
+ * @returns {bool} true if something was opened.
+ */
+bool revdev::open(const uint16_t vendor, const uint16_t product) {
+   const char* recording = getenv("TRS80_KEYBOARD_REPLAY");
+   if (recording && *recording) {
+      return replay(recording);
+   }
+
+   DIR* dir = opendir("/dev/input");
+   if (!dir) {
+      return false;
+   }
+
+   bool found = false;
+   struct dirent* entry;
+   while (!found && (entry = readdir(dir)) != NULL) {
+      if (strncmp(entry->d_name, "event", 5) != 0) {
+         continue;
+      }
+      if (!openPath(string("/dev/input/") + entry->d_name)) {
+         continue;
+      }
+      rawId id;
+      if (ioctl(descriptor, ioctlGetId, &id) == 0 && id.vendor == vendor && id.product == product) {
+         found = true;
+      } else {
+         close();
+      }
+   }
+   closedir(dir);
+   return found;
+}
+
+/**
+ * @method replay
+ * Reads input_events from a file (e.g. a copy of an event node)
+ * instead of a device.  fill() returns 0 once it's all been read.
+ * @param {const string&} recording - the file to read.
+ * @returns {bool} true if it could be opened.
+ */
+bool revdev::replay(const string& recording) {
+   if (!openPath(recording)) {
+      return false;
+   }
+   replaying = true;
+   return true;
+}
+
+/**
+ * @method close
+ * Closes the device (releasing any grab).
+ */
+void revdev::close() {
+   if (descriptor >= 0) {
+      ::close(descriptor);
+   }
+   descriptor = -1;
+   replaying = false;
+   ended = false;
+   batchHead = 0;
+   batchTail = 0;
+   modifiers = 0;
+   path = "";
+}
+
+/**
+ * @method grab
+ * Takes (or gives back) exclusive use of the device, so its keys stop
+ * reaching the tty too.  Release it before handing the terminal to a
+ * child.  Replays have nothing to grab.
+ * @param {const bool} exclusive - whether to hold the grab.
+ * @returns {bool} true on success.
+ */
+bool revdev::grab(const bool exclusive) {
+   if (descriptor < 0) {
+      return false;
+   }
+   if (replaying) {
+      return true;
+   }
+   return ioctl(descriptor, ioctlGrab, exclusive ? 1 : 0) == 0;
+}
+
+/**
+ * @method fd
+ * @returns {int} the descriptor to poll, or -1 if nothing is open.
+ */
+int revdev::fd() const {
+   return descriptor;
+}
+
+/**
+ * @method isReplay
+ * @returns {bool} true if events are coming from a recording.
+ */
+bool revdev::isReplay() const {
+   return replaying;
+}
+
+/**
+ * @method finished
+ * @returns {bool} true once a recording has been read to the end or the
+ * device has gone away.
+ */
+bool revdev::finished() const {
+   return ended;
+}
+
+/**
+ * @method fill
+ * Reads as many whole events as are ready (up to a batch) with one
+ * read().  Doesn't block.
+ * @returns {size_t} the number of events read, 0 if none were ready
+ * (see finished()).
+ */
+size_t revdev::fill() {
+   if (descriptor < 0) {
+      return 0;
+   }
+
+   // keep whatever hasn't been taken yet
+   if (batchHead > 0) {
+      memmove(batch, batch + batchHead, (batchTail - batchHead) * sizeof(rawEvent));
+      batchTail -= batchHead;
+      batchHead = 0;
+   }
+   if (batchTail == batchSize) {
+      return 0;
+   }
+
+   ssize_t result;
+   do {
+      result = read(descriptor, batch + batchTail, (batchSize - batchTail) * sizeof(rawEvent));
+   } while (result < 0 && errno == EINTR);
+
+   if (result <= 0) {
+      if (result == 0 || errno != EAGAIN) {
+         ended = true;
+      }
+      return 0;
+   }
+   // the kernel only hands out whole events; a truncated
+   // recording's partial event at the end is dropped
+   size_t count = result / sizeof(rawEvent);
+   batchTail += count;
+   return count;
+}
+
+/**
+ * @method next
+ * Takes the next key event, skipping sync and other event types.
+ * @param {rkeyEvent&} event - filled in with the event.
+ * @returns {bool} false if no key event is buffered.
+ */
+bool revdev::next(rkeyEvent& event) {
+   while (batchHead < batchTail) {
+      const rawEvent& raw = batch[batchHead++];
+      if (raw.type != eventKey) {
+         continue;
+      }
+      event.time.tv_sec = raw.sec;
+      event.time.tv_usec = raw.usec;
+      event.code = raw.code;
+      event.value = raw.value;
+      event.key = translate(raw.code, raw.value);
+      return true;
+   }
+   return false;
+}
+
+/**
+ * @private
+ * @method translate
+ * Maps a kernel key code onto rkeyboard's KEY_ indices, keeping track
+ * of the modifier keys on the way.
+ * @returns {int} the KEY_ index (with KEY_MOD_ bits), or -1.
+ */
+int revdev::translate(const uint16_t code, const int value) {
+   // kernel key codes, from <linux/input-event-codes.h>
+   int modifier = 0;
+   switch (code) {
+      case 42: case 54: modifier = KEY_MOD_SHIFT; break; // left/right shift
+      case 29: case 97: modifier = KEY_MOD_CTRL; break;  // left/right ctrl
+      case 56: case 100: modifier = KEY_MOD_ALT; break;  // left/right alt
+      case 125: case 126: modifier = KEY_MOD_META; break; // left/right meta
+   }
+   if (modifier) {
+      if (value == REVDEV_RELEASE) {
+         modifiers &= ~modifier;
+      } else {
+         modifiers |= modifier;
+      }
+      return -1;
+   }
+
+   int key;
+   switch (code) {
+      case 103: key = KEY_UP; break;
+      case 108: key = KEY_DOWN; break;
+      case 106: key = KEY_RIGHT; break;
+      case 105: key = KEY_LEFT; break;
+      case 59: case 60: case 61: case 62: case 63:
+      case 64: case 65: case 66: case 67: case 68:
+         // F1 through F10 are consecutive in both
+         key = KEY_F1 + (code - 59);
+         break;
+      case 28: case 96: key = KEY_ENT; break; // enter, keypad enter
+      case 1: key = KEY_ESC; break;
+      default: return -1;
+   }
+   return key | modifiers;
+}
+
+#endif
@@ -0,0 +1,394 @@
+/*
+ * Class: rfuzzy
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ * Author: Renee Waverly Sonntag
+ *
+ * Description:
+ *
+ *      Fuzzy filtering of an ritems list as a pattern is typed: an item
+ *      matches if the pattern's characters appear in its name in order
+ *      (ASCII letters ignoring case), and the matches are ranked so names
+ *      where they fall at word starts and next to each other come first.
+ *
+ *      Typing is incremental.  Whatever matches "abc" is a subset of what
+ *      matched "ab", so each keystroke only looks at the previous
+ *      keystroke's matches, and the results for every shorter pattern are
+ *      kept so backspace is free.
+ *
+ *      Before any name is compared byte by byte, a cheap test throws most
+ *      of them out: every item gets a 32-bit mask of which kinds of bytes
+ *      it contains (one bit per letter, a few for digits, punctuation and
+ *      non-ASCII), and an item can only match if its mask has every bit the
+ *      pattern's does.  Starting over on the whole list tests four masks at
+ *      a time with SSE2 or NEON (see rutf8.h).
+ */
+
+#ifndef RFUZZY_H
+#define RFUZZY_H
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+
+#include "ritems.h"
+#include "rutf8.h"
+
+using namespace std;
+
+class rfuzzy {
+   private:
+      struct unit {
+         uint16_t offset; // into pattern
+         uint16_t length;
+      };
+
+      // the matches for one pattern, in list order, and their scores
+      struct level {
+         string pattern;
+         vector<uint32_t> matches;
+         vector<uint32_t> scores;
+      };
+
+      const ritems* items;
+      vector<uint32_t> masks;
+      bool stale;
+
+      vector<level> levels;
+
+      // the current pattern, folded, split into characters
+      string pattern;
+      vector<unit> units;
+      uint32_t patternMask;
+
+      vector<uint64_t> keys;
+      vector<uint32_t> ranked;
+
+      static unsigned char fold(const unsigned char);
+      static uint32_t maskOf(const char*, const size_t);
+
+      void rebuild();
+      void setPattern(const string&);
+      bool unitAt(const string_view, const size_t, const unit&) const;
+      int score(const string_view, vector<size_t>*) const;
+      void test(level&, const uint32_t) const;
+
+   public:
+      rfuzzy(const ritems*);
+
+      void setItems(const ritems*);
+      void invalidate();
+
+      const vector<uint32_t>& filter(const string&);
+      bool positions(const size_t, vector<size_t>&);
+};
+
+/**
+ * @constructs rfuzzy
+ * @param {const ritems*} newitems - the list to filter.
+ */
+rfuzzy::rfuzzy(const ritems* newitems) {
+   items = newitems;
+   stale = true;
+   patternMask = 0;
+}
+
+/**
+ * @method setItems
+ * Switches to another list.
+ * @param {const ritems*} newitems - the list to filter.
+ */
+void rfuzzy::setItems(const ritems* newitems) {
+   items = newitems;
+   stale = true;
+}
+
+/**
+ * @method invalidate
+ * Call whenever the list changes (items added, removed or reordered).
+ */
+void rfuzzy::invalidate() {
+   stale = true;
+}
+
+/**
+ * @private
+ * @method fold
+ * @returns {unsigned char} the byte, lowercased if it's an ASCII letter.
+ */
+unsigned char rfuzzy::fold(const unsigned char c) {
+   return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+/**
+ * @private
+ * @method maskOf
+ * @returns {uint32_t} one bit for each kind of byte in the string: a-z
+ * (either case) are bits 0-25, 0-4 and 5-9 are 26 and 27, '.' is 28,
+ * space, '-' and '_' are 29, any other ASCII is 30 and non-ASCII is 31.
+ */
+uint32_t rfuzzy::maskOf(const char* str, const size_t length) {
+   uint32_t mask = 0;
+   for (size_t i = 0; i < length; i++) {
+      unsigned char c = fold(str[i]);
+      int bit;
+      if (c >= 'a' && c <= 'z') {
+         bit = c - 'a';
+      } else if (c >= '0' && c <= '9') {
+         bit = (c < '5') ? 26 : 27;
+      } else if (c == '.') {
+         bit = 28;
+      } else if (c == ' ' || c == '-' || c == '_') {
+         bit = 29;
+      } else {
+         bit = (c < 0x80) ? 30 : 31;
+      }
+      mask |= (uint32_t) 1 << bit;
+   }
+   return mask;
+}
+
+/**
+ * @private
+ * @method rebuild
+ * Works out every item's mask and forgets the old results.
+ */
+void rfuzzy::rebuild() {
+   stale = false;
+   masks.resize(items->size());
+   for (size_t i = 0; i < masks.size(); i++) {
+      string_view name = (*items)[i];
+      masks[i] = maskOf(name.data(), name.length());
+   }
+   masks.shrink_to_fit();
+   levels.clear();
+}
+
+/**
+ * @private
+ * @method setPattern
+ * Folds the pattern and splits it into characters, each of which has to
+ * match a whole character of a name.
+ */
+void rfuzzy::setPattern(const string& newPattern) {
+   pattern.resize(newPattern.length());
+   for (size_t i = 0; i < newPattern.length(); i++) {
+      pattern[i] = fold(newPattern[i]);
+   }
+
+   units.clear();
+   size_t i = 0;
+   while (i < pattern.length()) {
+      size_t start = i;
+      decode_utf8(pattern.data(), pattern.length(), i);
+      units.push_back({(uint16_t) start, (uint16_t) (i - start)});
+   }
+   patternMask = maskOf(pattern.data(), pattern.length());
+}
+
+/**
+ * @private
+ * @method unitAt
+ * @returns {bool} true if the pattern character is at byte i of the name.
+ * A lead byte never equals a continuation byte, so a match is always on a
+ * character boundary.
+ */
+bool rfuzzy::unitAt(const string_view name, const size_t i, const unit& u) const {
+   if (u.length == 1) {
+      return fold(name[i]) == (unsigned char) pattern[u.offset];
+   }
+   return i + u.length <= name.length() && memcmp(name.data() + i, pattern.data() + u.offset, u.length) == 0;
+}
+
+/**
+ * @private
+ * @method score
+ * Finds the pattern in the name.  The first place it ends is found going
+ * forwards, then the latest place it can start going back from there, so
+ * the match is as tight as it can be without trying every alignment.
+ * @param {vector<size_t>*} found - if not NULL, gets the byte offset of
+ * each matched character.
+ * @returns {int} the score (higher is better), or -1 if it doesn't match.
+ */
+int rfuzzy::score(const string_view name, vector<size_t>* found) const {
+   const size_t count = units.size();
+   const size_t length = name.length();
+
+   // forwards: where does the earliest complete match end?
+   size_t u = 0;
+   size_t end = 0;
+   for (size_t i = 0; i < length && u < count; i++) {
+      if (unitAt(name, i, units[u])) {
+         i += units[u].length - 1;
+         end = i + 1;
+         u++;
+      }
+   }
+   if (u < count) {
+      return -1;
+   }
+
+   // backwards from there: where can it start at the latest?
+   size_t start = end;
+   for (size_t k = count; k > 0; k--) {
+      const unit& back = units[k - 1];
+      size_t i = start - back.length;
+      while (!unitAt(name, i, back)) {
+         i--;
+      }
+      start = i;
+   }
+
+   // forwards again inside that window, scoring each character
+   int total = 0;
+   size_t previousEnd = string::npos;
+   u = 0;
+   for (size_t i = start; i < end && u < count; i++) {
+      if (!unitAt(name, i, units[u])) {
+         continue;
+      }
+      total += 16;
+
+      unsigned char before = (i > 0) ? name[i - 1] : ' ';
+      bool wordStart = before == ' ' || before == '-' || before == '_' || before == '.' || before == '/'
+         || (before >= 'a' && before <= 'z' && name[i] >= 'A' && name[i] <= 'Z');
+      if (wordStart) {
+         total += 10;
+      }
+      if (i == previousEnd) {
+         total += 6;
+      } else if (previousEnd != string::npos) {
+         total -= min(i - previousEnd, (size_t) 12);
+      }
+
+      if (found) {
+         found->push_back(i);
+      }
+      i += units[u].length - 1;
+      previousEnd = i + 1;
+      u++;
+   }
+
+   // a little for matching nearer the start
+   total -= min(start, (size_t) 10);
+   return max(total, 0);
+}
+
+/**
+ * @private
+ * @method test
+ * Scores one item that passed the mask test and keeps it if it matches.
+ */
+void rfuzzy::test(level& next, const uint32_t index) const {
+   int points = score((*items)[index], NULL);
+   if (points >= 0) {
+      next.matches.push_back(index);
+      next.scores.push_back(points);
+   }
+}
+
+/**
+ * @method filter
+ * Narrows the list down to the items matching a pattern, building on the
+ * last call's results when the pattern only grew or shrank.
+ * @param {const string&} newPattern - what's been typed.
+ * @returns {const vector<uint32_t>&} the matching items, best first (ties
+ * keep list order); valid until the next call.  An empty pattern matches
+ * everything.
+ */
+const vector<uint32_t>& rfuzzy::filter(const string& newPattern) {
+   if (stale) {
+      rebuild();
+   }
+   setPattern(newPattern);
+
+   // drop the results for any pattern this one doesn't start with
+   while (!levels.empty() && pattern.compare(0, levels.back().pattern.length(), levels.back().pattern) != 0) {
+      levels.pop_back();
+   }
+
+   if (levels.empty() || levels.back().pattern != pattern) {
+      level next;
+      next.pattern = pattern;
+
+      if (levels.empty()) {
+         // starting over: test every mask, four at a time if possible
+         size_t i = 0;
+         const size_t total = masks.size();
+#if defined(RUTF8_SSE2)
+         const __m128i want = _mm_set1_epi32(patternMask);
+         for (; i + 4 <= total; i += 4) {
+            __m128i have = _mm_loadu_si128((const __m128i*) (masks.data() + i));
+            int hits = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(have, want), want)));
+            while (hits) {
+               test(next, i + __builtin_ctz(hits));
+               hits &= hits - 1;
+            }
+         }
+#elif defined(RUTF8_NEON)
+         const uint32x4_t want = vdupq_n_u32(patternMask);
+         for (; i + 4 <= total; i += 4) {
+            uint32x4_t have = vld1q_u32(masks.data() + i);
+            uint32_t hits[4];
+            vst1q_u32(hits, vceqq_u32(vandq_u32(have, want), want));
+            for (size_t lane = 0; lane < 4; lane++) {
+               if (hits[lane]) {
+                  test(next, i + lane);
+               }
+            }
+         }
+#endif
+         for (; i < total; i++) {
+            if ((masks[i] & patternMask) == patternMask) {
+               test(next, i);
+            }
+         }
+      } else {
+         // refining: only what matched a shorter pattern can match this one
+         for (uint32_t index : levels.back().matches) {
+            if ((masks[index] & patternMask) == patternMask) {
+               test(next, index);
+            }
+         }
+      }
+
+      next.matches.shrink_to_fit();
+      next.scores.shrink_to_fit();
+      levels.push_back(move(next));
+   }
+
+   // rank: best score first, then list order, packed so one sort does both
+   const level& current = levels.back();
+   keys.resize(current.matches.size());
+   for (size_t i = 0; i < keys.size(); i++) {
+      keys[i] = ((uint64_t) (UINT32_MAX - current.scores[i]) << 32) | current.matches[i];
+   }
+   sort(keys.begin(), keys.end());
+
+   ranked.resize(keys.size());
+   for (size_t i = 0; i < keys.size(); i++) {
+      ranked[i] = (uint32_t) keys[i];
+   }
+   return ranked;
+}
+
+/**
+ * @method positions
+ * Finds which characters of an item the last filter() pattern matched,
+ * for highlighting them.
+ * @param {const size_t} index - the item.
+ * @param {vector<size_t>&} found - gets the byte offset of each one.
+ * @returns {bool} false if the item doesn't match.
+ */
+bool rfuzzy::positions(const size_t index, vector<size_t>& found) {
+   found.clear();
+   if (index >= items->size()) {
+      return false;
+   }
+   return score((*items)[index], &found) >= 0;
+}
+
+#endif
@@ -0,0 +1,422 @@
+/*
+ * Class: ritems
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ * Author: Renee Waverly Sonntag
+ *
+ * Description:
+ *
+ *      A compact list of names.  Instead of one std::string (and, for
+ *      anything past the small-string limit, one heap allocation) per name,
+ *      every name is appended to a single arena and the list itself is just
+ *      an offset, a length and a few flag bits per entry: 8 bytes plus the
+ *      name's own bytes.  Names come back as string_views into the arena.
+ *
+ *      A 200k-file directory goes from tens of thousands of small
+ *      allocations scattered across the heap of a 512 MB Pi to two
+ *      contiguous blocks.  Sorting, inserting and removing only move the
+ *      8-byte entries.  The arena is append-only, except that once erased
+ *      names make up half of it, it's packed down to the names still
+ *      listed, so a directory that keeps changing doesn't grow it forever.
+ */
+
+#ifndef RITEMS_H
+#define RITEMS_H
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+
+using namespace std;
+
+/*
+ * Flags an item can carry, combine with |
+ */
+#define RI_NONE 0
+#define RI_EXECUTABLE 1
+#define RI_DIRECTORY 2
+
+class ritems {
+   private:
+      struct entry {
+         uint32_t offset;
+         uint16_t length;
+         uint16_t flags;
+      };
+
+      vector<char> arena;
+      vector<entry> entries;
+
+      // bytes in the arena that no entry uses any more
+      size_t deadBytes = 0;
+
+      // below this the arena isn't worth packing
+      static constexpr size_t compactAbove = 4096;
+
+      entry store(const string_view, const uint16_t);
+      void packInto(ritems&) const;
+      void compact();
+
+   public:
+      /*
+       * What a comparator for sort() is handed.
+       */
+      struct item {
+         string_view name;
+         uint16_t flags;
+      };
+
+      size_t size() const;
+      bool empty() const;
+      string_view operator[](const size_t) const;
+      uint16_t flags(const size_t) const;
+      item at(const size_t) const;
+
+      void reserve(const size_t, const size_t);
+      void push_back(const string_view, const uint16_t = RI_NONE);
+      void append(const ritems&);
+      void insert(const size_t, const string_view, const uint16_t = RI_NONE);
+      void erase(const size_t);
+      void clear();
+      void shrink_to_fit();
+      void swap(ritems&);
+
+      template <class Compare>
+      void sort(Compare);
+      template <class Compare>
+      size_t mergeSorted(const size_t, Compare);
+      template <class Compare>
+      size_t lowerBound(const string_view, const uint16_t, Compare) const;
+      template <class Compare>
+      size_t insertSorted(const string_view, const uint16_t, Compare);
+
+      string serialize() const;
+      bool deserialize(const char*, const size_t);
+
+      size_t memoryUsed() const;
+};
+
+/**
+ * @private
+ * @method store
+ * Copies the name into the arena.  Names are cut at 65535 bytes, far past
+ * anything a filesystem allows.
+ */
+ritems::entry ritems::store(const string_view name, const uint16_t flags) {
+   size_t length = min(name.length(), (size_t) UINT16_MAX);
+   entry e = {(uint32_t) arena.size(), (uint16_t) length, flags};
+   arena.insert(arena.end(), name.data(), name.data() + length);
+   return e;
+}
+
+/**
+ * @method size
+ * @returns {size_t} the number of items.
+ */
+size_t ritems::size() const {
+   return entries.size();
+}
+
+/**
+ * @method empty
+ * @returns {bool} true if there are no items.
+ */
+bool ritems::empty() const {
+   return entries.empty();
+}
+
+/**
+ * @method operator[]
+ * @param {const size_t} index - which item.
+ * @returns {string_view} its name; valid until the next push_back/insert/clear.
+ */
+string_view ritems::operator[](const size_t index) const {
+   const entry& e = entries[index];
+   return string_view(arena.data() + e.offset, e.length);
+}
+
+/**
+ * @method flags
+ * @param {const size_t} index - which item.
+ * @returns {uint16_t} its RI_ flags.
+ */
+uint16_t ritems::flags(const size_t index) const {
+   return entries[index].flags;
+}
+
+/**
+ * @method at
+ * @param {const size_t} index - which item.
+ * @returns {item} its name and flags.
+ */
+ritems::item ritems::at(const size_t index) const {
+   return {(*this)[index], entries[index].flags};
+}
+
+/**
+ * @method reserve
+ * @param {const size_t} count - how many items to make room for.
+ * @param {const size_t} bytes - how many bytes of names to make room for.
+ */
+void ritems::reserve(const size_t count, const size_t bytes) {
+   entries.reserve(count);
+   arena.reserve(bytes);
+}
+
+/**
+ * @method push_back
+ * Adds an item at the end.
+ * @param {const string_view} name - the name, copied into the arena.
+ * @param {const uint16_t} flags - RI_ flags for it.
+ */
+void ritems::push_back(const string_view name, const uint16_t flags) {
+   entries.push_back(store(name, flags));
+}
+
+/**
+ * @method append
+ * Adds all of another list's items at the end.
+ * @param {const ritems&} other - the items to copy.
+ */
+void ritems::append(const ritems& other) {
+   uint32_t base = arena.size();
+   arena.insert(arena.end(), other.arena.begin(), other.arena.end());
+   entries.reserve(entries.size() + other.entries.size());
+   for (const entry& e : other.entries) {
+      entries.push_back({base + e.offset, e.length, e.flags});
+   }
+   deadBytes += other.deadBytes;
+}
+
+/**
+ * @method insert
+ * Adds an item before the given index (e.g. to keep the list sorted).
+ * @param {const size_t} index - where it goes.
+ * @param {const string_view} name - the name, copied into the arena.
+ * @param {const uint16_t} flags - RI_ flags for it.
+ */
+void ritems::insert(const size_t index, const string_view name, const uint16_t flags) {
+   entries.insert(entries.begin() + min(index, entries.size()), store(name, flags));
+}
+
+/**
+ * @method erase
+ * Removes an item.  Its bytes stay in the arena until erased names take
+ * up half of it, when the arena is packed (which, like push_back, moves
+ * the names other string_views point at).
+ * @param {const size_t} index - which item.
+ */
+void ritems::erase(const size_t index) {
+   if (index < entries.size()) {
+      deadBytes += entries[index].length;
+      entries.erase(entries.begin() + index);
+      if (arena.size() >= compactAbove && deadBytes * 2 > arena.size()) {
+         compact();
+      }
+   }
+}
+
+/**
+ * @method clear
+ * Removes every item, keeping the allocations for reuse.
+ */
+void ritems::clear() {
+   entries.clear();
+   arena.clear();
+   deadBytes = 0;
+}
+
+/**
+ * @private
+ * @method packInto
+ * Copies the items, in order, into a list whose arena holds only their
+ * names.
+ * @param {ritems&} packed - an empty list to fill.
+ */
+void ritems::packInto(ritems& packed) const {
+   packed.reserve(entries.size(), arena.size() - deadBytes);
+   for (size_t i = 0; i < entries.size(); i++) {
+      packed.push_back((*this)[i], entries[i].flags);
+   }
+}
+
+/**
+ * @private
+ * @method compact
+ * Drops erased names from the arena.
+ */
+void ritems::compact() {
+   ritems packed;
+   packInto(packed);
+   swap(packed);
+}
+
+/**
+ * @method shrink_to_fit
+ * Gives back whatever the arena and list reserved but didn't use.
+ */
+void ritems::shrink_to_fit() {
+   entries.shrink_to_fit();
+   arena.shrink_to_fit();
+}
+
+/**
+ * @method swap
+ * Exchanges contents with another list without copying any names.
+ * @param {ritems&} other - the list to swap with.
+ */
+void ritems::swap(ritems& other) {
+   arena.swap(other.arena);
+   entries.swap(other.entries);
+   std::swap(deadBytes, other.deadBytes);
+}
+
+/**
+ * @method sort
+ * Stable-sorts the items.  Only the entries move.
+ * @param {Compare} less - takes two (const item&) and returns a bool.
+ */
+template <class Compare>
+void ritems::sort(Compare less) {
+   const char* base = arena.data();
+   stable_sort(entries.begin(), entries.end(), [base, &less](const entry& a, const entry& b) {
+      return less(item{string_view(base + a.offset, a.length), a.flags},
+         item{string_view(base + b.offset, b.length), b.flags});
+   });
+}
+
+/**
+ * @method mergeSorted
+ * For lists that arrive in pieces: sorts the items from first on and
+ * merges them into the items before first, which must already be sorted
+ * the same way.  The old items ahead of the first new one aren't touched,
+ * so the cost is linear in what's after it, plus sorting the new part.
+ * @param {const size_t} first - where the new items start.
+ * @param {Compare} less - takes two (const item&) and returns a bool.
+ * @returns {size_t} the first index whose item changed (size() if none).
+ */
+template <class Compare>
+size_t ritems::mergeSorted(const size_t first, Compare less) {
+   if (first >= entries.size()) {
+      return entries.size();
+   }
+   const char* base = arena.data();
+   auto compare = [base, &less](const entry& a, const entry& b) {
+      return less(item{string_view(base + a.offset, a.length), a.flags},
+         item{string_view(base + b.offset, b.length), b.flags});
+   };
+   stable_sort(entries.begin() + first, entries.end(), compare);
+
+   // equal items stay behind the old ones, as with a stable merge
+   auto from = upper_bound(entries.begin(), entries.begin() + first, entries[first], compare);
+   inplace_merge(from, entries.begin() + first, entries.end(), compare);
+   return from - entries.begin();
+}
+
+/**
+ * @method lowerBound
+ * Binary-searches a sorted list.
+ * @param {const string_view} name - the name to look for.
+ * @param {const uint16_t} flags - its flags, if the order depends on them.
+ * @param {Compare} less - the order the list is sorted in.
+ * @returns {size_t} the first index whose item doesn't sort before it
+ * (where it is, or where it would go).
+ */
+template <class Compare>
+size_t ritems::lowerBound(const string_view name, const uint16_t flags, Compare less) const {
+   const char* base = arena.data();
+   auto at = lower_bound(entries.begin(), entries.end(), item{name, flags}, [base, &less](const entry& a, const item& b) {
+      return less(item{string_view(base + a.offset, a.length), a.flags}, b);
+   });
+   return at - entries.begin();
+}
+
+/**
+ * @method insertSorted
+ * Adds an item to a sorted list where it belongs.
+ * @param {const string_view} name - the name, copied into the arena.
+ * @param {const uint16_t} flags - RI_ flags for it.
+ * @param {Compare} less - the order the list is sorted in.
+ * @returns {size_t} the index it went in at.
+ */
+template <class Compare>
+size_t ritems::insertSorted(const string_view name, const uint16_t flags, Compare less) {
+   size_t index = lowerBound(name, flags, less);
+   insert(index, name, flags);
+   return index;
+}
+
+/**
+ * @method serialize
+ * Packs the list into bytes for saving (e.g. see rlistcache.h): the
+ * number of items and of arena bytes, the entries as they are in memory,
+ * then the arena, with erased names dropped.  Only meant to be read back
+ * on the same machine.
+ * @returns {string} the bytes.
+ */
+string ritems::serialize() const {
+   // only the names still listed
+   ritems packed;
+   packInto(packed);
+
+   uint32_t counts[2] = {(uint32_t) packed.entries.size(), (uint32_t) packed.arena.size()};
+   string bytes;
+   bytes.reserve(sizeof counts + packed.entries.size() * sizeof(entry) + packed.arena.size());
+   bytes.append((const char*) counts, sizeof counts);
+   bytes.append((const char*) packed.entries.data(), packed.entries.size() * sizeof(entry));
+   bytes.append(packed.arena.data(), packed.arena.size());
+   return bytes;
+}
+
+/**
+ * @method deserialize
+ * Replaces the list with one packed by serialize(), checking that every
+ * entry is inside the data.
+ * @param {const char*} data - the bytes (e.g. an mmap()ed file).
+ * @param {const size_t} length - how many there are.
+ * @returns {bool} false (leaving the list empty) if they don't make sense.
+ */
+bool ritems::deserialize(const char* data, const size_t length) {
+   clear();
+
+   uint32_t counts[2];
+   if (length < sizeof counts) {
+      return false;
+   }
+   memcpy(counts, data, sizeof counts);
+   // compared with what's left rather than summed, which could wrap
+   // where size_t is 32 bits
+   size_t left = length - sizeof counts;
+   if (counts[0] > left / sizeof(entry)) {
+      return false;
+   }
+   size_t entryBytes = (size_t) counts[0] * sizeof(entry);
+   left -= entryBytes;
+   if (counts[1] != left) {
+      return false;
+   }
+
+   entries.resize(counts[0]);
+   memcpy(entries.data(), data + sizeof counts, entryBytes);
+   arena.assign(data + sizeof counts + entryBytes, data + length);
+   for (const entry& e : entries) {
+      if ((size_t) e.offset + e.length > arena.size()) {
+         clear();
+         return false;
+      }
+   }
+   return true;
+}
+
+/**
+ * @method memoryUsed
+ * @returns {size_t} the bytes allocated for the arena and the list.
+ */
+size_t ritems::memoryUsed() const {
+   return arena.capacity() + entries.capacity() * sizeof(entry);
+}
+
+#endif
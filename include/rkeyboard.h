@@ -20,9 +20,15 @@
 #define RKEYBOARD_H
 
 #include <string>
+#include <algorithm>
 #include <termios.h>
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 using namespace std;
 
@@ -48,6 +54,311 @@ using namespace std;
 #define KEY_F10 13 // not present on the TRS-80 Model 100
 //#define KEY_RSRVD 14
 #define KEY_ENT 15
+#define KEY_ESC 16 // escape pressed on its own
+
+/*
+ * xterm-style modifiers (CSI 1;N x) are or'ed onto the key above,
+ * e.g. KEY_UP | KEY_MOD_CTRL.  KEY_BASE() strips them again.
+ */
+#define KEY_MOD_SHIFT 0x100
+#define KEY_MOD_ALT 0x200
+#define KEY_MOD_CTRL 0x400
+#define KEY_MOD_META 0x800
+#define KEY_BASE(key) ((key) & 0xFF)
+
+/*
+ * Class: rkeyboard
+ *
+ * Puts the tty into non-canonical, no-echo mode once for the life of the
+ * program instead of flipping it around every keypress, and reads whatever
+ * input is available in chunks into a ring buffer.  Pasted text and fast
+ * typing no longer get lost (or echoed) between termios flips, and
+ * getch() is usually just a pop from the buffer.
+ *
+ * The original terminal settings are put back when the object is
+ * destroyed, at exit(), or on a fatal signal.  Use suspend()/resume()
+ * around child processes that expect a normal terminal.
+ */
+class rkeyboard {
+   private:
+      static constexpr size_t bufferSize = 4096; // must be a power of 2
+
+      struct termios savedAttributes;
+      bool haveSavedAttributes;
+      bool raw;
+
+      unsigned char buffer[bufferSize];
+      size_t head; // next byte to pop
+      size_t tail; // next byte to fill
+
+      static rkeyboard* active;
+      static void restoreAtExit();
+      static void signalHandler(int);
+
+      void enterRaw();
+      void leaveRaw();
+
+   public:
+      rkeyboard();
+      ~rkeyboard();
+
+      // how long to wait for the rest of an escape sequence
+      // before deciding that escape was pressed on its own
+      int escapeTimeout;
+
+      static rkeyboard& session();
+
+      void suspend();
+      void resume();
+
+      int fd() const;
+      size_t available() const;
+      size_t fill();
+      int pop();
+      bool putBack(const unsigned char*, const size_t);
+      int getch();
+      int getch(const int);
+};
+
+rkeyboard* rkeyboard::active = NULL;
+
+/**
+ * @constructs rkeyboard
+ * Saves the current terminal settings and switches to raw input.
+ */
+rkeyboard::rkeyboard() {
+   head = 0;
+   tail = 0;
+   raw = false;
+   escapeTimeout = 50;
+   haveSavedAttributes = (tcgetattr(STDIN_FILENO, &savedAttributes) == 0);
+
+   active = this;
+
+   static bool registered = false;
+   if (!registered) {
+      registered = true;
+      atexit(restoreAtExit);
+
+      // only take over signals nobody else is handling
+      int fatal[] = {SIGINT, SIGTERM, SIGHUP, SIGQUIT};
+      for (int signum : fatal) {
+         struct sigaction current;
+         if (sigaction(signum, NULL, &current) == 0 && current.sa_handler == SIG_DFL) {
+            struct sigaction action;
+            memset(&action, 0, sizeof action);
+            action.sa_handler = signalHandler;
+            action.sa_flags = SA_RESETHAND;
+            sigemptyset(&action.sa_mask);
+            sigaction(signum, &action, NULL);
+         }
+      }
+   }
+
+   enterRaw();
+}
+
+/**
+ * @destructs rkeyboard
+ * Puts the terminal back the way it was found.
+ */
+rkeyboard::~rkeyboard() {
+   leaveRaw();
+   if (active == this) {
+      active = NULL;
+   }
+}
+
+/**
+ * @method session
+ * @returns {rkeyboard&} the keyboard in use, creating one on first use.
+ */
+rkeyboard& rkeyboard::session() {
+   if (active) {
+      return *active;
+   }
+   static rkeyboard fallback;
+   return fallback;
+}
+
+/**
+ * @private
+ * @method restoreAtExit
+ * atexit() hook so that exit() from anywhere leaves a usable terminal.
+ */
+void rkeyboard::restoreAtExit() {
+   if (active) {
+      active->leaveRaw();
+   }
+}
+
+/**
+ * @private
+ * @method signalHandler
+ * Restores the terminal, then lets the signal do what it would have done.
+ * tcsetattr() is async-signal-safe.
+ */
+void rkeyboard::signalHandler(int signum) {
+   if (active && active->raw && active->haveSavedAttributes) {
+      tcsetattr(STDIN_FILENO, TCSANOW, &active->savedAttributes);
+   }
+   // SA_RESETHAND already put the default action back
+   raise(signum);
+}
+
+/**
+ * @private
+ * @method enterRaw
+ * Disables line buffering and echo.  Signals (^C) still work.
+ */
+void rkeyboard::enterRaw() {
+   if (raw || !haveSavedAttributes) {
+      return;
+   }
+   struct termios newattr = savedAttributes;
+   newattr.c_lflag &= ~(ICANON | ECHO);
+   newattr.c_cc[VMIN] = 1;
+   newattr.c_cc[VTIME] = 0;
+   if (tcsetattr(STDIN_FILENO, TCSANOW, &newattr) == 0) {
+      raw = true;
+   }
+}
+
+/**
+ * @private
+ * @method leaveRaw
+ * Restores the saved terminal settings.
+ */
+void rkeyboard::leaveRaw() {
+   if (!raw) {
+      return;
+   }
+   tcsetattr(STDIN_FILENO, TCSANOW, &savedAttributes);
+   raw = false;
+}
+
+/**
+ * @method suspend
+ * Gives the terminal back its original settings, e.g. before running
+ * another program in it.
+ */
+void rkeyboard::suspend() {
+   leaveRaw();
+}
+
+/**
+ * @method resume
+ * Switches back to raw input after suspend().  Also picks up any settings
+ * the other program may have left behind.
+ */
+void rkeyboard::resume() {
+   enterRaw();
+}
+
+/**
+ * @method fd
+ * @returns {int} the descriptor input is read from, for poll().
+ */
+int rkeyboard::fd() const {
+   return STDIN_FILENO;
+}
+
+/**
+ * @method available
+ * @returns {size_t} how many bytes are already buffered.
+ */
+size_t rkeyboard::available() const {
+   return tail - head;
+}
+
+/**
+ * @method fill
+ * Reads everything the tty has for us (up to the free space in the
+ * buffer) with a single read().  Blocks only if nothing is available.
+ * @returns {size_t} the number of bytes read, 0 on end of input or error.
+ */
+size_t rkeyboard::fill() {
+   size_t space = bufferSize - available();
+   if (space == 0) {
+      return 0;
+   }
+
+   // read into the contiguous part of the free space
+   size_t at = tail & (bufferSize - 1);
+   size_t length = min(space, bufferSize - at);
+
+   ssize_t result;
+   do {
+      result = read(STDIN_FILENO, buffer + at, length);
+   } while (result < 0 && errno == EINTR);
+
+   if (result <= 0) {
+      return 0;
+   }
+   tail += result;
+   return result;
+}
+
+/**
+ * @method pop
+ * @returns {int} the next buffered byte, or -1 if the buffer is empty.
+ */
+int rkeyboard::pop() {
+   if (head == tail) {
+      return -1;
+   }
+   return buffer[(head++) & (bufferSize - 1)];
+}
+
+/**
+ * @method putBack
+ * Returns bytes to the front of the buffer, to be popped again next.
+ * @param {const unsigned char*} bytes - the bytes, in the order they
+ * were popped.
+ * @param {const size_t} length - how many.
+ * @returns {bool} false if there isn't room for them.
+ */
+bool rkeyboard::putBack(const unsigned char* bytes, const size_t length) {
+   if (bufferSize - available() < length) {
+      return false;
+   }
+   head -= length;
+   for (size_t i = 0; i < length; i++) {
+      buffer[(head + i) & (bufferSize - 1)] = bytes[i];
+   }
+   return true;
+}
+
+/**
+ * @method getch
+ * @returns {int} the next byte of input, waiting for it if needed,
+ * or EOF if the input has gone away.
+ */
+int rkeyboard::getch() {
+   if (head == tail && fill() == 0) {
+      return EOF;
+   }
+   return pop();
+}
+
+/**
+ * @method getch
+ * @param {const int} timeout - milliseconds to wait if nothing is buffered.
+ * @returns {int} the next byte of input, or EOF if none arrived in time.
+ */
+int rkeyboard::getch(const int timeout) {
+   if (head == tail) {
+      struct pollfd waitFor = {STDIN_FILENO, POLLIN, 0};
+      int ready;
+      do {
+         ready = poll(&waitFor, 1, timeout);
+      } while (ready < 0 && errno == EINTR);
+      if (ready <= 0 || fill() == 0) {
+         return EOF;
+      }
+   }
+   return pop();
+}
 
 /**
  * @function getch
@@ -56,36 +367,50 @@ using namespace std;
  * @returns {int} the character retrieved from the buffer.
  */
 int getch() {
-   struct termios oldattr, newattr;
-   int ch;
-   tcgetattr(STDIN_FILENO, &oldattr);
-   newattr = oldattr;
-   newattr.c_lflag &= ~(ICANON | ECHO);
-   tcsetattr(STDIN_FILENO, TCSANOW, &newattr);
-   ch = getchar();
-   tcsetattr(STDIN_FILENO, TCSANOW, &oldattr);
-   return ch;
+   return rkeyboard::session().getch();
 }
 
-/**
- * @function resolveEscapeSequence
- * Detects a control sequence and determines if it matches any that we're interested in.
+/*
+ * Class: rescapeTrie
  *
- * I tried integrating rterm and tput with it,
- * but tput doesn't necessarily return the control sequences
- * that the keyboard will output.
- * (Which, unless I messed up and it actually does, is annoying).
+ * A trie over every escape sequence we recognize, built entirely at
+ * compile time.  Each node lists its children as a sibling chain, so
+ * decoding is one short scan per byte with no allocation and, unlike the
+ * old substring search, only real prefixes can match.
  *
- * @returns {int} the index of the "special key" that the control sequence matches.
+ * vt100, xterm function key codes: https://invisible-island.net/xterm/xterm-function-keys.html
  */
-int resolveEscapeSequence() {
-   int matches = 1;
-   string sequence = "\x1B";
-   
-   // vt100, xterm function key codes: https://invisible-island.net/xterm/xterm-function-keys.html
-   string candidates[] = {
+class rescapeTrie {
+   public:
+      struct node {
+         unsigned char byte;
+         short child;
+         short sibling;
+         short key;
+      };
+
+      static constexpr size_t maxNodes = 640;
+
+      node nodes[maxNodes];
+      size_t count;
+      bool overflow;
+
+      constexpr rescapeTrie();
+      constexpr void insert(const char*, size_t, short);
+      constexpr short step(short, unsigned char) const;
+};
+
+/**
+ * @constructs rescapeTrie
+ * Fills in the vt100, rxvt, linux console and Model F tables plus the
+ * modifier-encoded xterm family.
+ */
+constexpr rescapeTrie::rescapeTrie() : nodes{}, count(1), overflow(false) {
+   nodes[0] = {0, -1, -1, -1};
+
+   const char* candidates[] = {
       // Format:
-      // up     down    left    right
+      // up     down    right   left
       // f1     f2      f3      f4
       // f5     f6      f7      f8
       // f9     f10     rsrvd   enter
@@ -96,33 +421,223 @@ int resolveEscapeSequence() {
       "\x1BOt", "\x1BOu", "\x1BOv", "\x1BOl",
       "\x1BOw", "\x1BOx", "", "\x1BOM",
 
-      // rxvt:
+      // rxvt (and xterm/linux for the ones they share):
       "\x1B[A", "\x1B[B", "\x1B[C", "\x1B[D",
       "\x1B[11~", "\x1B[12~", "\x1B[13~", "\x1B[14~",
       "\x1B[15~", "\x1B[17~", "\x1B[18~", "\x1B[19~",
       "\x1B[20~", "\x1B[21~", "", "\x1BOM",
 
-      // A Raspberry Pi + IBM Model F setup produced different f1-f5 codes than expected:
+      // A Raspberry Pi + IBM Model F setup produced different f1-f5 codes than expected
+      // (these are also the linux console's):
       "", "", "", "",
       "\x1B[[A", "\x1B[[B", "\x1B[[C", "\x1B[[D",
       "\x1B[[E", "", "", "",
       "", "", "", ""
    };
-   
-   while (matches > 0) {
-      matches = 0;
-      
-      // Get another character
-      sequence += getch();
-      
-      for (size_t i = 0; i < (sizeof(candidates)/sizeof(candidates[0])); i++) {
-         if (candidates[i].find(sequence) != string::npos) {
-            matches++;
-            if (candidates[i].length() == sequence.length()) {
-               return i % 16;
-            }
+
+   for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+      size_t length = 0;
+      while (candidates[i][length]) {
+         length++;
+      }
+      if (length > 0) {
+         insert(candidates[i], length, i % 16);
+      }
+   }
+
+   // xterm with modifiers: CSI 1;N A-D for the arrows, CSI 1;N P-S for
+   // f1-f4 and CSI nn;N ~ for f5-f10, where N-1 is the modifier bitmask
+   // (N runs to 16 with meta, so it can be two digits)
+   const char arrows[] = {'A', 'B', 'C', 'D'};
+   const char function[] = {'P', 'Q', 'R', 'S'};
+   const char* numbered[] = {"15", "17", "18", "19", "20", "21"};
+   for (int n = 2; n <= 16; n++) {
+      short modifiers = (n - 1) << 8;
+      char digits[2] = {(char) ('0' + n % 10), 0};
+      size_t width = 1;
+      if (n >= 10) {
+         digits[0] = (char) ('0' + n / 10);
+         digits[1] = (char) ('0' + n % 10);
+         width = 2;
+      }
+
+      char sequence[8] = {'\x1B', '[', '1', ';', digits[0], digits[1], 0, 0};
+      for (short i = 0; i < 4; i++) {
+         sequence[4 + width] = arrows[i];
+         insert(sequence, 5 + width, (KEY_UP + i) | modifiers);
+         sequence[4 + width] = function[i];
+         insert(sequence, 5 + width, (KEY_F1 + i) | modifiers);
+      }
+      for (short i = 0; i < 6; i++) {
+         char tilde[8] = {'\x1B', '[', numbered[i][0], numbered[i][1], ';', digits[0], digits[1], 0};
+         tilde[5 + width] = '~';
+         insert(tilde, 6 + width, (KEY_F5 + i) | modifiers);
+      }
+   }
+}
+
+/**
+ * @method insert
+ * Adds a sequence to the trie.
+ * @param {const char*} sequence - the bytes of the sequence.
+ * @param {size_t} length - how many bytes.
+ * @param {short} key - the KEY_ code it produces.
+ */
+constexpr void rescapeTrie::insert(const char* sequence, size_t length, short key) {
+   short at = 0;
+   for (size_t i = 0; i < length; i++) {
+      unsigned char byte = sequence[i];
+      short next = step(at, byte);
+      if (next < 0) {
+         if (count >= maxNodes) {
+            overflow = true;
+            return;
          }
+         next = count++;
+         nodes[next] = {byte, -1, nodes[at].child, -1};
+         nodes[at].child = next;
+      }
+      at = next;
+   }
+   nodes[at].key = key;
+}
+
+/**
+ * @method step
+ * @param {short} state - the current node.
+ * @param {unsigned char} byte - the next byte of input.
+ * @returns {short} the next node, or -1 if no sequence continues this way.
+ */
+constexpr short rescapeTrie::step(short state, unsigned char byte) const {
+   for (short child = nodes[state].child; child >= 0; child = nodes[child].sibling) {
+      if (nodes[child].byte == byte) {
+         return child;
+      }
+   }
+   return -1;
+}
+
+constexpr rescapeTrie escapeTrie;
+static_assert(!escapeTrie.overflow, "rescapeTrie::maxNodes is too small");
+
+/*
+ * Class: rescapeDecoder
+ *
+ * Walks escapeTrie one byte at a time.
+ */
+class rescapeDecoder {
+   private:
+      short state;
+
+   public:
+      static const int pending = -2;
+      static const int noMatch = -1;
+
+      rescapeDecoder();
+      void reset();
+      int feed(const unsigned char);
+};
+
+/**
+ * @constructs rescapeDecoder
+ */
+rescapeDecoder::rescapeDecoder() {
+   reset();
+}
+
+/**
+ * @method reset
+ * Starts over at the beginning of a sequence.
+ */
+void rescapeDecoder::reset() {
+   state = 0;
+}
+
+/**
+ * @method feed
+ * @param {const unsigned char} byte - the next byte of input.
+ * @returns {int} a KEY_ code once a sequence is complete, pending while
+ * more bytes are needed, or noMatch if it isn't a sequence we know.
+ */
+int rescapeDecoder::feed(const unsigned char byte) {
+   state = escapeTrie.step(state, byte);
+   if (state < 0) {
+      reset();
+      return noMatch;
+   }
+   if (escapeTrie.nodes[state].key >= 0) {
+      int key = escapeTrie.nodes[state].key;
+      reset();
+      return key;
+   }
+   return pending;
+}
+
+/**
+ * @function resolveEscapeSequence
+ * Detects a control sequence and determines if it matches any that we're interested in.
+ * Call it after getch() returned an escape.
+ *
+ * I tried integrating rterm and tput with it,
+ * but tput doesn't necessarily return the control sequences
+ * that the keyboard will output.
+ * (Which, unless I messed up and it actually does, is annoying).
+ *
+ * If nothing follows the escape within the session's escapeTimeout, it was
+ * the escape key on its own.  Alt-x arrives as ESC x, so when the byte
+ * after the escape can't start a sequence it's put back for the caller's
+ * next getch().  A CSI (ESC [) or SS3 (ESC O) sequence we don't know,
+ * like Home or Delete, is read to its end and dropped instead, so none of
+ * it gets typed.
+ *
+ * @returns {int} the index of the "special key" that the control sequence matches
+ * (possibly with KEY_MOD_ bits), KEY_ESC, or -1.
+ */
+int resolveEscapeSequence() {
+   rkeyboard& keyboard = rkeyboard::session();
+   rescapeDecoder decoder;
+   decoder.feed(0x1B);
+
+   int first = keyboard.getch(keyboard.escapeTimeout);
+   if (first == EOF) {
+      return KEY_ESC;
+   }
+   int result = decoder.feed(first);
+   if (result == rescapeDecoder::noMatch) {
+      unsigned char back = first;
+      keyboard.putBack(&back, 1);
+      return -1;
+   }
+
+   // c is the last byte read, previous the one before it
+   int previous = first;
+   size_t length = 1;
+   int c = first;
+   while (result == rescapeDecoder::pending) {
+      previous = c;
+      c = keyboard.getch(keyboard.escapeTimeout);
+      if (c == EOF) {
+         // cut short; what came is dropped
+         return -1;
+      }
+      length++;
+      result = decoder.feed(c);
+   }
+   if (result != rescapeDecoder::noMatch || first == 'O') {
+      // a key, or SS3's one byte
+      return result;
+   }
+
+   // the rest of an unknown CSI: parameters and intermediates up to a
+   // final byte (the linux console's ESC [ [ x is over at x)
+   bool linuxFunction = length == 3 && previous == '[';
+   size_t limit = 32;
+   while (!linuxFunction && !(c >= 0x40 && c <= 0x7E) && length < limit) {
+      c = keyboard.getch(keyboard.escapeTimeout);
+      if (c == EOF) {
+         break;
       }
+      length++;
    }
    return -1;
 }
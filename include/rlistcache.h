@@ -0,0 +1,283 @@
+/*
+ * Class: rlistcache
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ * Author: Renee Waverly Sonntag
+ *
+ * Description:
+ *
+ *      Keeps a directory's sorted listing on disk between runs, so a
+ *      browser started on a slow SD card can paint the last listing it had
+ *      straight away instead of waiting for a scan.  It's then up to the
+ *      program to check it against the directory in the background and
+ *      patch any differences (see menu's revalidate).
+ *
+ *      One file per directory, named after its device and inode, under
+ *      $XDG_CACHE_HOME/trs80-pi (or ~/.cache/trs80-pi).  Each holds a
+ *      small header (the directory's device, inode and mtime, and the
+ *      widest name so the layout can be worked out without measuring)
+ *      followed by ritems::serialize()'s bytes: 8 bytes per entry plus the
+ *      names.  Files are mmap()ed to load, and written to a temporary file
+ *      of their own and renamed into place, off the main thread, so a
+ *      reader never sees half of one.
+ *
+ *      Loading a listing touches its file, and each save trims the
+ *      directory back to the most recently used listingLimit files and
+ *      listingBytes bytes, so listings of directories that were deleted or
+ *      haven't been visited in a long time don't pile up.
+ */
+
+#ifndef RLISTCACHE_H
+#define RLISTCACHE_H
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ritems.h"
+
+using namespace std;
+
+class rlistcache {
+   private:
+      struct header {
+         char magic[8];
+         uint64_t device;
+         uint64_t inode;
+         int64_t modifiedSeconds;
+         int64_t modifiedNanoseconds;
+         uint64_t widest;
+      };
+
+      static constexpr char magicBytes[8] = {'T', 'R', 'S', 'L', 'S', 'T', '0', '1'};
+
+      // how much is kept before the least recently used listings go
+      static constexpr size_t listingLimit = 64;
+      static constexpr off_t listingBytes = 32 << 20;
+
+      string directory;
+
+      string pathFor(const struct stat&) const;
+      static void write(const string, const string, const string);
+      static void prune(const string);
+
+   public:
+      rlistcache();
+
+      bool load(const struct stat&, ritems&, size_t&, bool&) const;
+      void save(const struct stat&, const ritems&, const size_t) const;
+};
+
+/**
+ * @constructs rlistcache
+ * Finds (and if need be makes) the directory the listings go in.  If
+ * there's nowhere to put them, nothing is ever loaded or saved.
+ */
+rlistcache::rlistcache() {
+   const char* base = getenv("XDG_CACHE_HOME");
+   string root;
+   if (base && *base) {
+      root = base;
+   } else if ((base = getenv("HOME")) && *base) {
+      root = string(base) + "/.cache";
+   } else {
+      return;
+   }
+
+   mkdir(root.c_str(), 0700);
+   string path = root + "/trs80-pi";
+   if (mkdir(path.c_str(), 0700) == 0 || errno == EEXIST) {
+      directory = path;
+   }
+}
+
+/**
+ * @private
+ * @method pathFor
+ * @returns {string} where a directory's listing is kept.
+ */
+string rlistcache::pathFor(const struct stat& info) const {
+   char name[64];
+   snprintf(name, sizeof name, "/listing-%llx-%llx", (unsigned long long) info.st_dev, (unsigned long long) info.st_ino);
+   return directory + name;
+}
+
+/**
+ * @method load
+ * Reads a directory's saved listing, if there is one.
+ * @param {const struct stat&} info - the directory's stat().
+ * @param {ritems&} items - gets the listing, sorted as it was saved.
+ * @param {size_t&} widest - gets the widest name's display width.
+ * @param {bool&} current - set to true if the directory's mtime hasn't
+ * changed since (nothing was added, removed or renamed).
+ * @returns {bool} true if items was filled in.
+ */
+bool rlistcache::load(const struct stat& info, ritems& items, size_t& widest, bool& current) const {
+   if (directory.empty()) {
+      return false;
+   }
+   int fd = open(pathFor(info).c_str(), O_RDONLY | O_CLOEXEC);
+   if (fd < 0) {
+      return false;
+   }
+   struct stat fileInfo;
+   if (fstat(fd, &fileInfo) < 0 || (size_t) fileInfo.st_size < sizeof(header)) {
+      close(fd);
+      return false;
+   }
+   size_t length = fileInfo.st_size;
+   void* mapped = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+   if (mapped == MAP_FAILED) {
+      close(fd);
+      return false;
+   }
+
+   const char* data = (const char*) mapped;
+   header h;
+   memcpy(&h, data, sizeof h);
+   bool loaded = memcmp(h.magic, magicBytes, sizeof magicBytes) == 0
+      && h.device == (uint64_t) info.st_dev && h.inode == (uint64_t) info.st_ino
+      && items.deserialize(data + sizeof h, length - sizeof h);
+   munmap(mapped, length);
+
+   // recently used, as far as prune() is concerned
+   if (loaded) {
+      futimens(fd, NULL);
+   }
+   close(fd);
+
+   if (loaded) {
+      widest = h.widest;
+      current = h.modifiedSeconds == info.st_mtim.tv_sec && h.modifiedNanoseconds == info.st_mtim.tv_nsec;
+   }
+   return loaded;
+}
+
+/**
+ * @method save
+ * Saves a directory's listing for next time.  The bytes are gathered
+ * here; the file is written in the background.
+ * @param {const struct stat&} info - the directory's stat() from before
+ * the listing was read.
+ * @param {const ritems&} items - the sorted listing.
+ * @param {const size_t} widest - the widest name's display width.
+ */
+void rlistcache::save(const struct stat& info, const ritems& items, const size_t widest) const {
+   if (directory.empty()) {
+      return;
+   }
+
+   header h;
+   memcpy(h.magic, magicBytes, sizeof magicBytes);
+   h.device = info.st_dev;
+   h.inode = info.st_ino;
+   h.modifiedSeconds = info.st_mtim.tv_sec;
+   h.modifiedNanoseconds = info.st_mtim.tv_nsec;
+   h.widest = widest;
+
+   string bytes((const char*) &h, sizeof h);
+   bytes += items.serialize();
+   thread(write, directory, pathFor(info), move(bytes)).detach();
+}
+
+/**
+ * @private
+ * @method write
+ * Writes a file under a temporary name of its own (two saves of the same
+ * directory can overlap) and renames it into place, then prunes.
+ */
+void rlistcache::write(const string directory, const string path, const string bytes) {
+   string temporary = path + ".tmpXXXXXX";
+   int fd = mkostemp(&temporary[0], O_CLOEXEC);
+   if (fd < 0) {
+      return;
+   }
+   size_t written = 0;
+   while (written < bytes.length()) {
+      ssize_t result = ::write(fd, bytes.data() + written, bytes.length() - written);
+      if (result < 0 && errno == EINTR) {
+         continue;
+      }
+      if (result <= 0) {
+         break;
+      }
+      written += result;
+   }
+   close(fd);
+
+   if (written == bytes.length() && rename(temporary.c_str(), path.c_str()) == 0) {
+      prune(directory);
+   } else {
+      unlink(temporary.c_str());
+   }
+}
+
+/**
+ * @private
+ * @method prune
+ * Removes the least recently used listings beyond listingLimit files or
+ * listingBytes bytes, and temporary files left behind by a crash.
+ */
+void rlistcache::prune(const string directory) {
+   DIR* dir = opendir(directory.c_str());
+   if (!dir) {
+      return;
+   }
+
+   struct listing {
+      string name;
+      struct timespec used;
+      off_t size;
+   };
+   vector<listing> listings;
+   time_t now = time(NULL);
+
+   struct dirent* entry;
+   while ((entry = readdir(dir)) != NULL) {
+      if (strncmp(entry->d_name, "listing-", 8) != 0) {
+         continue;
+      }
+      struct stat info;
+      if (fstatat(dirfd(dir), entry->d_name, &info, AT_SYMLINK_NOFOLLOW) < 0) {
+         continue;
+      }
+      if (strstr(entry->d_name, ".tmp")) {
+         // another save's, unless it's been there far longer than one takes
+         if (now - info.st_mtim.tv_sec > 3600) {
+            unlinkat(dirfd(dir), entry->d_name, 0);
+         }
+         continue;
+      }
+      listings.push_back({entry->d_name, info.st_mtim, info.st_size});
+   }
+
+   // newest first
+   sort(listings.begin(), listings.end(), [](const listing& a, const listing& b) {
+      if (a.used.tv_sec != b.used.tv_sec) {
+         return a.used.tv_sec > b.used.tv_sec;
+      }
+      return a.used.tv_nsec > b.used.tv_nsec;
+   });
+   off_t kept = 0;
+   for (size_t i = 0; i < listings.size(); i++) {
+      kept += listings[i].size;
+      if (i >= listingLimit || kept > listingBytes) {
+         unlinkat(dirfd(dir), listings[i].name.c_str(), 0);
+      }
+   }
+   closedir(dir);
+}
+
+#endif
@@ -0,0 +1,514 @@
+/*
+ * Class: rloop
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ * Author: Renee Waverly Sonntag
+ *
+ * Description:
+ *
+ *      A small single-threaded event loop.  Everything a program waits on
+ *      (the keyboard, timers, signals, child processes) becomes a file
+ *      descriptor in one poll() set, and the matching callback runs when
+ *      it's ready.  Because all callbacks run on the one thread there is
+ *      nothing to lock, output never interleaves, and the process sleeps
+ *      in poll() between events instead of spinning.
+ *
+ *      Timers are timerfds, signals arrive through a signalfd (so they are
+ *      blocked for normal delivery while the loop exists), and each child
+ *      gets a pidfd that becomes readable when it exits.  addAligned's
+ *      timers follow the wall clock's own second (or minute) boundaries,
+ *      so a clock drawn from them never drifts off them.  Kernels without
+ *      pidfd_open (before 5.3) fall back to collecting children on SIGCHLD.
+ *      Removed watches' slots are reused, and the poll() set is only
+ *      rebuilt when a watch is added, removed, enabled or disabled, so a
+ *      long-running program that starts many children and scans doesn't
+ *      walk a growing list on every wakeup.
+ *
+ *      A child started while the loop's signals are blocked should call
+ *      rloop::prepareChild() before exec so that it gets a normal signal
+ *      mask, or be spawned with rloop::childSignalMask() (see rspawn.h).
+ */
+
+#ifndef RLOOP_H
+#define RLOOP_H
+
+#include <functional>
+#include <map>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+class rloop {
+   private:
+      struct watch {
+         int fd;
+         short events;
+         bool enabled;
+         bool removed;
+         bool ownsFd;
+         function<void(short)> callback;
+      };
+
+      vector<watch> watches;
+      bool running;
+
+      // slots that can be reused, and ones removed since the poll() set
+      // was last built (not reused until then, in case a callback
+      // that's still to be dispatched refers to them)
+      vector<int> freeWatches;
+      vector<int> retiredWatches;
+
+      // the poll() set and which watch each entry is
+      vector<struct pollfd> pollSet;
+      vector<int> pollIds;
+      bool pollSetChanged;
+
+      int signalFd;
+      int signalWatch;
+      sigset_t signalMask;
+      map<int, function<void(const signalfd_siginfo&)>> signalHandlers;
+
+      map<pid_t, function<void(pid_t, int)>> children;
+
+      static sigset_t originalMask;
+      static bool haveOriginalMask;
+
+      void rebuildPollSet();
+      void dispatchSignals();
+      void reapChildren();
+      static int openPidfd(const pid_t);
+
+   public:
+      rloop();
+      ~rloop();
+
+      int addFd(const int, const short, function<void(short)>);
+      void removeFd(const int);
+      void setEnabled(const int, const bool);
+
+      int addTimer(const struct itimerspec&, function<void()>, const int = 0, const clockid_t = CLOCK_MONOTONIC);
+      int addInterval(const long, function<void()>);
+      int addAligned(const long, function<void()>);
+      bool setTimer(const int, const struct itimerspec&, const int = 0);
+
+      void addSignal(const int, function<void(const signalfd_siginfo&)>);
+      void watchChild(const pid_t, function<void(pid_t, int)>);
+
+      bool runOnce(const int = -1);
+      void run();
+      void stop();
+
+      static void prepareChild();
+      static void childSignalMask(sigset_t&);
+};
+
+sigset_t rloop::originalMask;
+bool rloop::haveOriginalMask = false;
+
+/**
+ * @constructs rloop
+ */
+rloop::rloop() {
+   running = false;
+   pollSetChanged = false;
+   signalFd = -1;
+   signalWatch = -1;
+   sigemptyset(&signalMask);
+}
+
+/**
+ * @destructs rloop
+ * Closes the descriptors the loop created and unblocks its signals.
+ */
+rloop::~rloop() {
+   for (auto& w : watches) {
+      if (w.ownsFd && !w.removed) {
+         close(w.fd);
+      }
+   }
+   if (signalFd >= 0) {
+      close(signalFd);
+   }
+   if (haveOriginalMask) {
+      sigprocmask(SIG_SETMASK, &originalMask, NULL);
+   }
+}
+
+/**
+ * @method addFd
+ * Calls back whenever the descriptor is ready.
+ * @param {const int} fd - the descriptor to watch.
+ * @param {const short} events - poll() events, usually POLLIN.
+ * @param {function<void(short)>} callback - receives the returned events.
+ * @returns {int} an id for removeFd/setEnabled.
+ */
+int rloop::addFd(const int fd, const short events, function<void(short)> callback) {
+   pollSetChanged = true;
+   if (!freeWatches.empty()) {
+      int id = freeWatches.back();
+      freeWatches.pop_back();
+      watches[id] = {fd, events, true, false, false, callback};
+      return id;
+   }
+   watches.push_back({fd, events, true, false, false, callback});
+   return watches.size() - 1;
+}
+
+/**
+ * @method removeFd
+ * Stops watching; closes the descriptor if the loop created it.  The id
+ * may be handed out again by a later add, so forget it.
+ * @param {const int} id - what addFd/addTimer returned.
+ */
+void rloop::removeFd(const int id) {
+   if (id < 0 || (size_t) id >= watches.size() || watches[id].removed) {
+      return;
+   }
+   if (watches[id].ownsFd) {
+      close(watches[id].fd);
+   }
+   watches[id].removed = true;
+   watches[id].callback = nullptr;
+   retiredWatches.push_back(id);
+   pollSetChanged = true;
+}
+
+/**
+ * @method setEnabled
+ * Temporarily ignores (or resumes watching) a descriptor without
+ * forgetting it, e.g. the keyboard while a child owns the terminal.
+ */
+void rloop::setEnabled(const int id, const bool enabled) {
+   if (id >= 0 && (size_t) id < watches.size() && watches[id].enabled != enabled) {
+      watches[id].enabled = enabled;
+      pollSetChanged = true;
+   }
+}
+
+/**
+ * @method addTimer
+ * Creates a timerfd and calls back every time it expires.
+ * @param {const struct itimerspec&} when - first expiry and interval.
+ * @param {function<void()>} callback - what to run.
+ * @param {const int} flags - timerfd_settime flags, e.g. TFD_TIMER_ABSTIME.
+ * @param {const clockid_t} clock - the clock to measure against.
+ * @returns {int} an id for setTimer/removeFd, or -1 on failure.
+ */
+int rloop::addTimer(const struct itimerspec& when, function<void()> callback, const int flags, const clockid_t clock) {
+   int fd = timerfd_create(clock, TFD_NONBLOCK | TFD_CLOEXEC);
+   if (fd < 0) {
+      return -1;
+   }
+   if (timerfd_settime(fd, flags, &when, NULL) < 0) {
+      close(fd);
+      return -1;
+   }
+
+   int id = addFd(fd, POLLIN, [fd, callback](short) {
+      uint64_t expirations;
+      if (read(fd, &expirations, sizeof expirations) == (ssize_t) sizeof expirations) {
+         callback();
+      }
+   });
+   watches[id].ownsFd = true;
+   return id;
+}
+
+/**
+ * @method addInterval
+ * @param {const long} milliseconds - how often to call back.
+ * @param {function<void()>} callback - what to run.
+ * @returns {int} an id for setTimer/removeFd, or -1 on failure.
+ */
+int rloop::addInterval(const long milliseconds, function<void()> callback) {
+   struct itimerspec when;
+   when.it_interval.tv_sec = milliseconds / 1000;
+   when.it_interval.tv_nsec = (milliseconds % 1000) * 1000000;
+   when.it_value = when.it_interval;
+   return addTimer(when, callback);
+}
+
+/**
+ * @method addAligned
+ * Calls back on every multiple of a period of wall clock time, e.g. as
+ * each second or minute starts.  The timer is absolute, so late wakeups
+ * don't add up, and if the system clock is set (NTP on a Pi without a
+ * real time clock) it's re-aligned and calls back straight away.
+ * @param {const long} seconds - the period.
+ * @param {function<void()>} callback - what to run.
+ * @returns {int} an id for setEnabled/removeFd, or -1 on failure.
+ */
+int rloop::addAligned(const long seconds, function<void()> callback) {
+   int fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+   if (fd < 0) {
+      return -1;
+   }
+
+   auto arm = [fd, seconds]() {
+      struct timespec now;
+      clock_gettime(CLOCK_REALTIME, &now);
+      struct itimerspec when;
+      when.it_value.tv_sec = (now.tv_sec / seconds + 1) * seconds;
+      when.it_value.tv_nsec = 0;
+      when.it_interval.tv_sec = seconds;
+      when.it_interval.tv_nsec = 0;
+      return timerfd_settime(fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &when, NULL) == 0;
+   };
+   if (!arm()) {
+      close(fd);
+      return -1;
+   }
+
+   int id = addFd(fd, POLLIN, [fd, arm, callback](short) {
+      uint64_t expirations;
+      ssize_t result = read(fd, &expirations, sizeof expirations);
+      if (result < 0 && errno == ECANCELED) {
+         // the clock was set
+         arm();
+      } else if (result != (ssize_t) sizeof expirations) {
+         return;
+      }
+      callback();
+   });
+   watches[id].ownsFd = true;
+   return id;
+}
+
+/**
+ * @method setTimer
+ * Re-arms (or with a zero it_value, disarms) a timer from addTimer.
+ * @returns {bool} true on success.
+ */
+bool rloop::setTimer(const int id, const struct itimerspec& when, const int flags) {
+   if (id < 0 || (size_t) id >= watches.size() || watches[id].removed) {
+      return false;
+   }
+   return timerfd_settime(watches[id].fd, flags, &when, NULL) == 0;
+}
+
+/**
+ * @method addSignal
+ * Blocks the signal and delivers it through the loop instead.
+ * @param {const int} signum - the signal.
+ * @param {function<void(const signalfd_siginfo&)>} callback - what to run.
+ */
+void rloop::addSignal(const int signum, function<void(const signalfd_siginfo&)> callback) {
+   if (!haveOriginalMask) {
+      sigprocmask(SIG_SETMASK, NULL, &originalMask);
+      haveOriginalMask = true;
+   }
+
+   if (callback) {
+      signalHandlers[signum] = callback;
+   }
+   sigaddset(&signalMask, signum);
+   sigprocmask(SIG_BLOCK, &signalMask, NULL);
+
+   // passing the existing descriptor just updates its mask
+   signalFd = signalfd(signalFd, &signalMask, SFD_NONBLOCK | SFD_CLOEXEC);
+   if (signalWatch < 0 && signalFd >= 0) {
+      signalWatch = addFd(signalFd, POLLIN, [this](short) {
+         dispatchSignals();
+      });
+   }
+}
+
+/**
+ * @private
+ * @method dispatchSignals
+ * Reads every queued signal and calls its handler.
+ */
+void rloop::dispatchSignals() {
+   signalfd_siginfo info;
+   while (read(signalFd, &info, sizeof info) == (ssize_t) sizeof info) {
+      if (info.ssi_signo == SIGCHLD) {
+         reapChildren();
+      }
+      auto handler = signalHandlers.find(info.ssi_signo);
+      if (handler != signalHandlers.end()) {
+         handler->second(info);
+      }
+   }
+}
+
+/**
+ * @private
+ * @method openPidfd
+ * @returns {int} a descriptor that polls readable once the child exits,
+ * or -1 if the kernel can't provide one.
+ */
+int rloop::openPidfd(const pid_t pid) {
+#ifdef SYS_pidfd_open
+   int fd = syscall(SYS_pidfd_open, pid, 0);
+   if (fd >= 0) {
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+   }
+   return fd;
+#else
+   (void) pid;
+   errno = ENOSYS;
+   return -1;
+#endif
+}
+
+/**
+ * @method watchChild
+ * Calls back (with the waitpid status) when the child exits.
+ * Only children registered here are reaped.
+ * @param {const pid_t} pid - the child.
+ * @param {function<void(pid_t, int)>} callback - what to run.
+ */
+void rloop::watchChild(const pid_t pid, function<void(pid_t, int)> callback) {
+   int fd = openPidfd(pid);
+   if (fd >= 0) {
+      // the pidfd is readable as soon as the child is a zombie
+      int id = addFd(fd, POLLIN, nullptr);
+      watches[id].ownsFd = true;
+      watches[id].callback = [this, id, pid, callback](short) {
+         int status = 0;
+         if (waitpid(pid, &status, WNOHANG) == 0) {
+            return;
+         }
+         removeFd(id);
+         callback(pid, status);
+      };
+      return;
+   }
+
+   if (!sigismember(&signalMask, SIGCHLD)) {
+      addSignal(SIGCHLD, nullptr);
+   }
+   children[pid] = callback;
+
+   // it may already be gone
+   reapChildren();
+}
+
+/**
+ * @private
+ * @method reapChildren
+ * Collects any watched children that have exited.
+ * SIGCHLD signals coalesce, so every watched child is checked.
+ */
+void rloop::reapChildren() {
+   for (auto child = children.begin(); child != children.end(); ) {
+      int status = 0;
+      pid_t result = waitpid(child->first, &status, WNOHANG);
+      if (result == child->first || (result < 0 && errno == ECHILD)) {
+         auto callback = child->second;
+         pid_t pid = child->first;
+         child = children.erase(child);
+         callback(pid, status);
+      } else {
+         ++child;
+      }
+   }
+}
+
+/**
+ * @private
+ * @method rebuildPollSet
+ * Gathers the enabled watches into the poll() set, and frees the slots
+ * of the ones removed since last time.
+ */
+void rloop::rebuildPollSet() {
+   freeWatches.insert(freeWatches.end(), retiredWatches.begin(), retiredWatches.end());
+   retiredWatches.clear();
+
+   pollSet.clear();
+   pollIds.clear();
+   for (size_t i = 0; i < watches.size(); i++) {
+      if (!watches[i].removed && watches[i].enabled) {
+         pollSet.push_back({watches[i].fd, watches[i].events, 0});
+         pollIds.push_back(i);
+      }
+   }
+   pollSetChanged = false;
+}
+
+/**
+ * @method runOnce
+ * Waits for events and dispatches them once.
+ * @param {const int} timeout - milliseconds to wait, -1 for forever.
+ * @returns {bool} false if there was nothing to wait for.
+ */
+bool rloop::runOnce(const int timeout) {
+   if (pollSetChanged) {
+      rebuildPollSet();
+   }
+   if (pollSet.empty()) {
+      return false;
+   }
+
+   int ready = poll(pollSet.data(), pollSet.size(), timeout);
+   if (ready <= 0) {
+      return true;
+   }
+
+   // by index: the set isn't rebuilt until the next runOnce
+   for (size_t i = 0; i < pollSet.size(); i++) {
+      // a callback may have removed or disabled this one
+      watch& w = watches[pollIds[i]];
+      if (pollSet[i].revents && !w.removed && w.enabled) {
+         auto callback = w.callback;
+         callback(pollSet[i].revents);
+      }
+   }
+   return true;
+}
+
+/**
+ * @method run
+ * Dispatches events until stop() is called.
+ */
+void rloop::run() {
+   running = true;
+   while (running && runOnce()) {
+   }
+}
+
+/**
+ * @method stop
+ * Makes run() return after the current callback.
+ */
+void rloop::stop() {
+   running = false;
+}
+
+/**
+ * @method prepareChild
+ * Call in a forked child before exec: restores the signal mask the
+ * process had before any loop blocked signals.
+ */
+void rloop::prepareChild() {
+   if (haveOriginalMask) {
+      sigprocmask(SIG_SETMASK, &originalMask, NULL);
+   }
+}
+
+/**
+ * @method childSignalMask
+ * For starting children without fork(): the signal mask prepareChild()
+ * would give them.
+ * @param {sigset_t&} mask - gets the mask.
+ */
+void rloop::childSignalMask(sigset_t& mask) {
+   if (haveOriginalMask) {
+      mask = originalMask;
+   } else {
+      sigprocmask(SIG_BLOCK, NULL, &mask);
+   }
+}
+
+#endif
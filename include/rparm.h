@@ -0,0 +1,498 @@
+/*
+ * Class: rparm
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ * Author: Renee Waverly Sonntag
+ *
+ * Description:
+ *
+ *      A compiled parameterized terminfo capability (cup, csr, hpa...).
+ *
+ *      The %-language from terminfo(5) is parsed once into a short list of
+ *      operations, so formatting a cursor move is a loop over a handful of
+ *      ops writing straight into a buffer the caller owns.  No strings are
+ *      built and nothing is allocated per call, which matters because the
+ *      file browser and the clock move the cursor constantly.
+ *
+ *      Supported: %% %c %d %o %x %X %s (integers only) with printf flags,
+ *      width and precision, %p1-%p9, %P/%g variables (a-z start at zero
+ *      on every call, A-Z keep their values between calls on the same
+ *      rparm, as with tparm), %'c', %{nn}, %l (0, as for any non-string),
+ *      arithmetic/logic/comparison operators, %i, and %? %t %e %;
+ *      conditionals including else-if chains.
+ *      Padding ($<...>) is dropped.
+ */
+
+#ifndef RPARM_H
+#define RPARM_H
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+using namespace std;
+
+class rparm {
+   private:
+      enum opcode : unsigned char {
+         OP_LITERAL,    // a = offset into literals, b = length
+         OP_PRINT,      // a = conversion, b = flags, c = width, d = precision
+         OP_PUSH_PARAM, // a = parameter index
+         OP_PUSH_CONST, // a = value
+         OP_SET_VAR,    // a = variable index (a-z dynamic, A-Z static)
+         OP_GET_VAR,    // a = variable index
+         OP_BINARY,     // a = operator character
+         OP_UNARY,      // a = operator character
+         OP_INCREMENT,  // %i
+         OP_JUMP_ZERO,  // a = target op
+         OP_JUMP        // a = target op
+      };
+
+      enum flag : unsigned char {
+         FLAG_LEFT = 1,
+         FLAG_PLUS = 2,
+         FLAG_SPACE = 4,
+         FLAG_ALT = 8,
+         FLAG_ZERO = 16
+      };
+
+      struct op {
+         opcode code;
+         unsigned char b;
+         int a;
+         short c;
+         short d;
+      };
+
+      static constexpr size_t stackDepth = 16;
+
+      vector<op> ops;
+      string literals;
+      size_t lastLabel;
+
+      // %PA-%PZ, which last from one format() to the next
+      mutable int staticVariables[26];
+
+      void appendLiteral(const char*, size_t);
+      static size_t formatNumber(char*, size_t, int, const op&);
+
+   public:
+      rparm();
+      rparm(const string&);
+
+      void compile(const string&);
+      bool empty() const;
+
+      size_t format(char*, size_t, int = 0, int = 0, int = 0, int = 0,
+         int = 0, int = 0, int = 0, int = 0, int = 0) const;
+};
+
+/**
+ * @constructs rparm
+ * An empty capability; format() will produce nothing.
+ */
+rparm::rparm() {
+   lastLabel = 0;
+   fill(staticVariables, staticVariables + 26, 0);
+}
+
+/**
+ * @constructs rparm
+ * @param {const string&} capability - the raw terminfo string to compile.
+ */
+rparm::rparm(const string& capability) {
+   fill(staticVariables, staticVariables + 26, 0);
+   compile(capability);
+}
+
+/**
+ * @method empty
+ * @returns {bool} true if the terminal didn't define this capability.
+ */
+bool rparm::empty() const {
+   return ops.empty();
+}
+
+/**
+ * @private
+ * @method appendLiteral
+ * Adds literal text, merging with the previous op if it was literal too
+ * and nothing jumps in between them.
+ */
+void rparm::appendLiteral(const char* text, size_t length) {
+   // never merge across a jump target
+   if (ops.size() > lastLabel && ops.back().code == OP_LITERAL
+         && (size_t) (ops.back().a + ops.back().b) == literals.length()
+         && ops.back().b + length <= 255) {
+      ops.back().b += length;
+   } else {
+      ops.push_back({OP_LITERAL, (unsigned char) length, (int) literals.length(), 0, 0});
+   }
+   literals.append(text, length);
+}
+
+/**
+ * @method compile
+ * Parses the %-language of a terminfo string into operations.
+ * Malformed sequences are copied through as literal text, which is
+ * what ncurses does too.
+ * @param {const string&} capability - the raw terminfo string.
+ */
+void rparm::compile(const string& capability) {
+   ops.clear();
+   literals.clear();
+   lastLabel = 0;
+
+   // for %? ... %; nesting: the unresolved %t jump and the %e jumps
+   struct frame {
+      long pendingTest;
+      vector<size_t> pendingElse;
+   };
+   vector<frame> conditionals;
+
+   const char* s = capability.c_str();
+   size_t n = capability.length();
+   size_t i = 0;
+   while (i < n) {
+      // padding
+      if (s[i] == '$' && i + 1 < n && s[i + 1] == '<') {
+         size_t close = capability.find('>', i);
+         if (close != string::npos) {
+            i = close + 1;
+            continue;
+         }
+      }
+
+      if (s[i] != '%' || i + 1 >= n) {
+         // gather a run of plain text
+         size_t start = i;
+         while (i < n && s[i] != '%' && !(s[i] == '$' && i + 1 < n && s[i + 1] == '<')) {
+            i++;
+         }
+         if (i == start) {
+            i++;
+         }
+         for (size_t j = start; j < i; j += 255) {
+            appendLiteral(s + j, min((size_t) 255, i - j));
+         }
+         continue;
+      }
+
+      size_t start = i;
+      i++;
+      char c = s[i++];
+      switch (c) {
+         case '%':
+            appendLiteral("%", 1);
+            break;
+         case 'p':
+            if (i < n && s[i] >= '1' && s[i] <= '9') {
+               ops.push_back({OP_PUSH_PARAM, 0, s[i] - '1', 0, 0});
+               i++;
+            }
+            break;
+         case 'P':
+         case 'g':
+            if (i < n && ((s[i] >= 'a' && s[i] <= 'z') || (s[i] >= 'A' && s[i] <= 'Z'))) {
+               int index = (s[i] >= 'a') ? (s[i] - 'a') : (26 + s[i] - 'A');
+               ops.push_back({(c == 'P') ? OP_SET_VAR : OP_GET_VAR, 0, index, 0, 0});
+               i++;
+            }
+            break;
+         case '\'':
+            if (i + 1 < n && s[i + 1] == '\'') {
+               ops.push_back({OP_PUSH_CONST, 0, (unsigned char) s[i], 0, 0});
+               i += 2;
+            }
+            break;
+         case '{': {
+            int value = 0;
+            bool negative = (i < n && s[i] == '-');
+            if (negative) {
+               i++;
+            }
+            while (i < n && s[i] >= '0' && s[i] <= '9') {
+               value = value * 10 + (s[i++] - '0');
+            }
+            if (i < n && s[i] == '}') {
+               i++;
+            }
+            ops.push_back({OP_PUSH_CONST, 0, negative ? -value : value, 0, 0});
+            break;
+         }
+         case 'l':
+         case '!': case '~':
+            ops.push_back({OP_UNARY, 0, c, 0, 0});
+            break;
+         case '+': case '-': case '*': case '/': case 'm':
+         case '&': case '|': case '^': case '=': case '>': case '<':
+         case 'A': case 'O':
+            ops.push_back({OP_BINARY, 0, c, 0, 0});
+            break;
+         case 'i':
+            ops.push_back({OP_INCREMENT, 0, 0, 0, 0});
+            break;
+         case '?':
+            conditionals.push_back({-1, {}});
+            break;
+         case 't':
+            if (!conditionals.empty()) {
+               conditionals.back().pendingTest = ops.size();
+               ops.push_back({OP_JUMP_ZERO, 0, 0, 0, 0});
+            }
+            break;
+         case 'e':
+            if (!conditionals.empty()) {
+               conditionals.back().pendingElse.push_back(ops.size());
+               ops.push_back({OP_JUMP, 0, 0, 0, 0});
+               if (conditionals.back().pendingTest >= 0) {
+                  ops[conditionals.back().pendingTest].a = ops.size();
+                  conditionals.back().pendingTest = -1;
+               }
+               lastLabel = ops.size();
+            }
+            break;
+         case ';':
+            if (!conditionals.empty()) {
+               if (conditionals.back().pendingTest >= 0) {
+                  ops[conditionals.back().pendingTest].a = ops.size();
+               }
+               for (auto jump : conditionals.back().pendingElse) {
+                  ops[jump].a = ops.size();
+               }
+               conditionals.pop_back();
+               lastLabel = ops.size();
+            }
+            break;
+         default: {
+            // %[[:]flags][width[.precision]][doxXcs]
+            i--;
+            op print = {OP_PRINT, 0, 0, 0, -1};
+            if (s[i] == ':') {
+               i++;
+            }
+            while (i < n && (s[i] == '-' || s[i] == '+' || s[i] == '#' || s[i] == ' ')) {
+               print.b |= (s[i] == '-') ? FLAG_LEFT : (s[i] == '+') ? FLAG_PLUS
+                  : (s[i] == '#') ? FLAG_ALT : FLAG_SPACE;
+               i++;
+            }
+            if (i < n && s[i] == '0') {
+               print.b |= FLAG_ZERO;
+               i++;
+            }
+            while (i < n && s[i] >= '0' && s[i] <= '9') {
+               print.c = print.c * 10 + (s[i++] - '0');
+            }
+            if (i < n && s[i] == '.') {
+               i++;
+               print.d = 0;
+               while (i < n && s[i] >= '0' && s[i] <= '9') {
+                  print.d = print.d * 10 + (s[i++] - '0');
+               }
+            }
+            if (i < n && (s[i] == 'd' || s[i] == 'o' || s[i] == 'x' || s[i] == 'X'
+                  || s[i] == 'c' || s[i] == 's')) {
+               print.a = s[i++];
+               ops.push_back(print);
+            } else {
+               // not something we understand, keep it as text
+               i = start + 1;
+               appendLiteral("%", 1);
+            }
+            break;
+         }
+      }
+   }
+
+   // an unterminated conditional ends with the string
+   for (auto& unterminated : conditionals) {
+      if (unterminated.pendingTest >= 0) {
+         ops[unterminated.pendingTest].a = ops.size();
+      }
+      for (auto jump : unterminated.pendingElse) {
+         ops[jump].a = ops.size();
+      }
+   }
+}
+
+/**
+ * @private
+ * @method formatNumber
+ * printf-style conversion of an integer, without printf.
+ * @returns {size_t} the number of bytes written (never more than room).
+ */
+size_t rparm::formatNumber(char* out, size_t room, int value, const op& print) {
+   char digits[16];
+   size_t count = 0;
+   unsigned base = (print.a == 'o') ? 8 : (print.a == 'x' || print.a == 'X') ? 16 : 10;
+   const char* symbols = (print.a == 'X') ? "0123456789ABCDEF" : "0123456789abcdef";
+
+   bool negative = (base == 10 && value < 0);
+   unsigned magnitude = negative ? -(unsigned) value : (unsigned) value;
+   do {
+      digits[count++] = symbols[magnitude % base];
+      magnitude /= base;
+   } while (magnitude && count < sizeof digits);
+
+   // a precision of zero prints nothing for zero, like printf
+   if (print.d == 0 && value == 0) {
+      count = 0;
+   }
+
+   size_t zeros = (print.d > 0 && (size_t) print.d > count) ? print.d - count : 0;
+
+   char sign = 0;
+   if (negative) {
+      sign = '-';
+   } else if (base == 10 && (print.b & FLAG_PLUS)) {
+      sign = '+';
+   } else if (base == 10 && (print.b & FLAG_SPACE)) {
+      sign = ' ';
+   }
+
+   const char* prefix = "";
+   if ((print.b & FLAG_ALT) && value != 0) {
+      prefix = (base == 16) ? ((print.a == 'X') ? "0X" : "0x") : (base == 8 && zeros == 0) ? "0" : "";
+   }
+   size_t prefixLength = (prefix[0] == 0) ? 0 : (prefix[1] == 0) ? 1 : 2;
+
+   size_t body = (sign ? 1 : 0) + prefixLength + zeros + count;
+   size_t padding = ((size_t) print.c > body) ? print.c - body : 0;
+   if ((print.b & FLAG_ZERO) && !(print.b & FLAG_LEFT) && print.d < 0) {
+      zeros += padding;
+      padding = 0;
+   }
+
+   size_t written = 0;
+   auto put = [&](char ch) {
+      if (written < room) {
+         out[written++] = ch;
+      }
+   };
+
+   if (!(print.b & FLAG_LEFT)) {
+      for (size_t j = 0; j < padding; j++) put(' ');
+   }
+   if (sign) put(sign);
+   for (size_t j = 0; j < prefixLength; j++) put(prefix[j]);
+   for (size_t j = 0; j < zeros; j++) put('0');
+   while (count > 0) put(digits[--count]);
+   if (print.b & FLAG_LEFT) {
+      for (size_t j = 0; j < padding; j++) put(' ');
+   }
+   return written;
+}
+
+/**
+ * @method format
+ * Runs the compiled capability with the given parameters.
+ * The result is always NUL-terminated and truncated to fit.
+ * @param {char*} buffer - where to write the sequence.
+ * @param {size_t} size - the size of the buffer (including the NUL).
+ * @param {int} p1..p9 - the capability's parameters.
+ * @returns {size_t} the number of bytes written, not counting the NUL.
+ */
+size_t rparm::format(char* buffer, size_t size, int p1, int p2, int p3, int p4,
+      int p5, int p6, int p7, int p8, int p9) const {
+   if (size == 0) {
+      return 0;
+   }
+
+   int params[9] = {p1, p2, p3, p4, p5, p6, p7, p8, p9};
+   int variables[26] = {0};
+   int stack[stackDepth];
+   size_t depth = 0;
+   size_t room = size - 1;
+   size_t written = 0;
+
+   auto push = [&](int value) {
+      if (depth < stackDepth) {
+         stack[depth++] = value;
+      }
+   };
+   auto pop = [&]() -> int {
+      return (depth > 0) ? stack[--depth] : 0;
+   };
+
+   size_t pc = 0;
+   while (pc < ops.size()) {
+      const op& o = ops[pc++];
+      switch (o.code) {
+         case OP_LITERAL: {
+            size_t length = min((size_t) o.b, room - written);
+            literals.copy(buffer + written, length, o.a);
+            written += length;
+            break;
+         }
+         case OP_PRINT:
+            if (o.a == 'c') {
+               if (written < room) {
+                  buffer[written++] = (char) pop();
+               }
+            } else {
+               written += formatNumber(buffer + written, room - written, pop(), o);
+            }
+            break;
+         case OP_PUSH_PARAM:
+            push(params[o.a]);
+            break;
+         case OP_PUSH_CONST:
+            push(o.a);
+            break;
+         case OP_SET_VAR:
+            if (o.a < 26) {
+               variables[o.a] = pop();
+            } else {
+               staticVariables[o.a - 26] = pop();
+            }
+            break;
+         case OP_GET_VAR:
+            push((o.a < 26) ? variables[o.a] : staticVariables[o.a - 26]);
+            break;
+         case OP_BINARY: {
+            int y = pop();
+            int x = pop();
+            switch (o.a) {
+               case '+': push(x + y); break;
+               case '-': push(x - y); break;
+               case '*': push(x * y); break;
+               case '/': push(y ? x / y : 0); break;
+               case 'm': push(y ? x % y : 0); break;
+               case '&': push(x & y); break;
+               case '|': push(x | y); break;
+               case '^': push(x ^ y); break;
+               case '=': push(x == y); break;
+               case '>': push(x > y); break;
+               case '<': push(x < y); break;
+               case 'A': push(x && y); break;
+               case 'O': push(x || y); break;
+            }
+            break;
+         }
+         case OP_UNARY: {
+            // %l is strlen(), and parameters are never strings
+            int x = pop();
+            push((o.a == '!') ? !x : (o.a == '~') ? ~x : 0);
+            break;
+         }
+         case OP_INCREMENT:
+            params[0]++;
+            params[1]++;
+            break;
+         case OP_JUMP_ZERO:
+            if (pop() == 0) {
+               pc = o.a;
+            }
+            break;
+         case OP_JUMP:
+            pc = o.a;
+            break;
+      }
+   }
+
+   buffer[written] = '\0';
+   return written;
+}
+
+#endif
@@ -0,0 +1,175 @@
+/*
+ * Class: rprefix
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ * Author: Renee Waverly Sonntag
+ *
+ * Description:
+ *
+ *      A prefix index over an ritems list, for looking names up as they're
+ *      typed.  The list itself stays in whatever order it's shown in; the
+ *      index is just the item numbers (4 bytes each) sorted by name, so
+ *      every name starting with a given prefix sits in one run that two
+ *      binary searches find.  Exact lookup, the number of matches and their
+ *      longest common prefix (the first and last of a sorted run share
+ *      exactly what the whole run shares) all cost O(log n + k) for a
+ *      k-byte key instead of a pass over every name.
+ *
+ *      The index is rebuilt lazily, on the first lookup after invalidate().
+ */
+
+#ifndef RPREFIX_H
+#define RPREFIX_H
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#include "ritems.h"
+
+using namespace std;
+
+class rprefix {
+   private:
+      const ritems* items;
+      vector<uint32_t> order;
+      bool stale;
+
+      void rebuild();
+      pair<size_t, size_t> range(const string_view);
+
+   public:
+      rprefix(const ritems*);
+
+      void setItems(const ritems*);
+      void invalidate();
+
+      size_t find(const string_view);
+      size_t count(const string_view);
+      string complete(const string_view);
+};
+
+/**
+ * @constructs rprefix
+ * @param {const ritems*} newitems - the list to index.
+ */
+rprefix::rprefix(const ritems* newitems) {
+   items = newitems;
+   stale = true;
+}
+
+/**
+ * @method setItems
+ * Switches to another list.
+ * @param {const ritems*} newitems - the list to index.
+ */
+void rprefix::setItems(const ritems* newitems) {
+   items = newitems;
+   stale = true;
+}
+
+/**
+ * @method invalidate
+ * Call whenever the list changes (items added, removed or reordered).
+ */
+void rprefix::invalidate() {
+   stale = true;
+}
+
+/**
+ * @private
+ * @method rebuild
+ * Sorts the item numbers by name.
+ */
+void rprefix::rebuild() {
+   stale = false;
+   order.resize(items->size());
+   for (size_t i = 0; i < order.size(); i++) {
+      order[i] = i;
+   }
+   const ritems& list = *items;
+   sort(order.begin(), order.end(), [&list](uint32_t a, uint32_t b) {
+      return list[a] < list[b];
+   });
+   order.shrink_to_fit();
+}
+
+/**
+ * @private
+ * @method range
+ * @returns {pair<size_t, size_t>} the run of order[] whose names start
+ * with the prefix, as [first, last).
+ */
+pair<size_t, size_t> rprefix::range(const string_view prefix) {
+   if (stale) {
+      rebuild();
+   }
+   const ritems& list = *items;
+
+   auto low = lower_bound(order.begin(), order.end(), prefix, [&list](uint32_t a, const string_view key) {
+      return list[a] < key;
+   });
+   // past the run once a name's first bytes compare greater than the prefix
+   auto high = upper_bound(low, order.end(), prefix, [&list](const string_view key, uint32_t a) {
+      return key < list[a].substr(0, key.length());
+   });
+   return {low - order.begin(), high - order.begin()};
+}
+
+/**
+ * @method find
+ * @param {const string_view} name - the whole name to look for.
+ * @returns {size_t} the item with exactly that name, or string::npos.
+ */
+size_t rprefix::find(const string_view name) {
+   auto run = range(name);
+   // the exact name, if there, sorts first in its own run
+   if (run.first < run.second && (*items)[order[run.first]] == name) {
+      return order[run.first];
+   }
+   return string::npos;
+}
+
+/**
+ * @method count
+ * @param {const string_view} prefix - the start of a name.
+ * @returns {size_t} how many names start with it.
+ */
+size_t rprefix::count(const string_view prefix) {
+   auto run = range(prefix);
+   return run.second - run.first;
+}
+
+/**
+ * @method complete
+ * Works out how far a Tab can complete: the whole name if only one
+ * starts with the prefix, otherwise as far as all of them agree.  Never
+ * stops in the middle of a UTF-8 character.
+ * @param {const string_view} prefix - the start of a name.
+ * @returns {string} the completion, or the prefix itself if nothing matches.
+ */
+string rprefix::complete(const string_view prefix) {
+   auto run = range(prefix);
+   if (run.first == run.second) {
+      return string(prefix);
+   }
+
+   string_view low = (*items)[order[run.first]];
+   string_view high = (*items)[order[run.second - 1]];
+   size_t length = prefix.length();
+   size_t most = min(low.length(), high.length());
+   while (length < most && low[length] == high[length]) {
+      length++;
+   }
+
+   // back up over a partly shared character (continuation bytes are 10xxxxxx)
+   while (length > prefix.length() && length < low.length() && ((unsigned char) low[length] & 0xC0) == 0x80) {
+      length--;
+   }
+   return string(low.substr(0, length));
+}
+
+#endif
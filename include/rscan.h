@@ -0,0 +1,327 @@
+/*
+ * Class: rscan
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ * Author: Renee Waverly Sonntag
+ *
+ * Description:
+ *
+ *      Lists a directory in the background and hands the names over in
+ *      batches, so a program can show the first page while a big directory
+ *      (on a slow SD card) is still being read.
+ *
+ *      filesystem::directory_iterator plus is_regular_file() and status()
+ *      costs up to two stat() calls per entry.  This reads the raw entries
+ *      with getdents64(), one large buffer per system call, and trusts the
+ *      d_type the kernel gives back: directories, devices and the like never
+ *      need a stat.  Regular files still need one for the executable bit, as
+ *      do symlinks and filesystems that leave d_type as DT_UNKNOWN, so a few
+ *      worker threads take turns reading a buffer of entries and then
+ *      fstatat() their own buffer's files in parallel with each other.
+ *
+ *      Finished batches are queued for the main thread, which is woken
+ *      through an eventfd that can sit in an rloop.
+ */
+
+#ifndef RSCAN_H
+#define RSCAN_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "ritems.h"
+
+using namespace std;
+
+// what classify() returns for entries that aren't listed
+#define RSCAN_SKIP UINT16_MAX
+
+class rscan {
+   private:
+      // the kernel's struct linux_dirent64
+      struct rawDirent {
+         uint64_t d_ino;
+         int64_t d_off;
+         unsigned short d_reclen;
+         unsigned char d_type;
+         char d_name[];
+      };
+
+      static constexpr size_t bufferSize = 32768;
+
+      int directoryFd;
+      int eventFd;
+
+      vector<thread> workers;
+      atomic<int> running;
+      atomic<bool> stopping;
+
+      // only one worker reads the directory at a time
+      mutex readLock;
+      bool exhausted;
+
+      mutex resultLock;
+      vector<ritems> ready;
+
+      void work();
+      void notify();
+
+   public:
+      // include subdirectories (flagged RI_DIRECTORY); "." and ".." never are
+      bool directories;
+
+      // errno from opening or reading the directory, 0 if none
+      // (a worker sets it if a read fails)
+      atomic<int> error;
+
+      rscan();
+      ~rscan();
+
+      static uint16_t classify(const int, const char*, const unsigned char, const bool);
+
+      bool start(const string&, const unsigned = 4);
+      void stop();
+
+      int fd() const;
+      size_t collect(ritems&);
+      bool done();
+};
+
+/**
+ * @constructs rscan
+ * Nothing happens until start().
+ */
+rscan::rscan() : running(0), stopping(false), error(0) {
+   directoryFd = -1;
+   eventFd = -1;
+   exhausted = true;
+   directories = false;
+}
+
+/**
+ * @destructs rscan
+ * Abandons any scan still running.
+ */
+rscan::~rscan() {
+   stop();
+}
+
+/**
+ * @method start
+ * Opens the directory and starts reading it in the background.
+ * @param {const string&} path - the directory.
+ * @param {const unsigned} threads - how many workers to use.
+ * @returns {bool} false if the directory couldn't be opened (see error).
+ */
+bool rscan::start(const string& path, const unsigned threads) {
+   stop();
+
+   directoryFd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   if (directoryFd < 0) {
+      error = errno;
+      return false;
+   }
+   eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   if (eventFd < 0) {
+      error = errno;
+      close(directoryFd);
+      directoryFd = -1;
+      return false;
+   }
+
+   error = 0;
+   exhausted = false;
+   stopping = false;
+   int count = (threads > 0) ? threads : 1;
+   running = count;
+   for (int i = 0; i < count; i++) {
+      workers.emplace_back(&rscan::work, this);
+   }
+   return true;
+}
+
+/**
+ * @method stop
+ * Stops the workers, waits for them, and throws away anything not yet
+ * collected.
+ */
+void rscan::stop() {
+   stopping = true;
+   for (auto& worker : workers) {
+      worker.join();
+   }
+   workers.clear();
+   running = 0;
+   ready.clear();
+
+   if (directoryFd >= 0) {
+      close(directoryFd);
+      directoryFd = -1;
+   }
+   if (eventFd >= 0) {
+      close(eventFd);
+      eventFd = -1;
+   }
+}
+
+/**
+ * @method fd
+ * @returns {int} a descriptor that polls readable when there's something
+ * to collect() (or the scan has finished), -1 if not started.
+ */
+int rscan::fd() const {
+   return eventFd;
+}
+
+/**
+ * @method collect
+ * Moves every finished batch onto the end of a list.
+ * @param {ritems&} into - the list to add to.
+ * @returns {size_t} the number of items added.
+ */
+size_t rscan::collect(ritems& into) {
+   uint64_t count;
+   if (eventFd >= 0) {
+      (void) !read(eventFd, &count, sizeof count);
+   }
+
+   vector<ritems> batches;
+   {
+      lock_guard<mutex> guard(resultLock);
+      batches.swap(ready);
+   }
+
+   size_t added = 0;
+   for (const auto& batch : batches) {
+      into.append(batch);
+      added += batch.size();
+   }
+   return added;
+}
+
+/**
+ * @method done
+ * @returns {bool} true once every entry has been read and collected.
+ */
+bool rscan::done() {
+   if (running > 0) {
+      return false;
+   }
+   lock_guard<mutex> guard(resultLock);
+   return ready.empty();
+}
+
+/**
+ * @private
+ * @method notify
+ * Wakes whoever is polling fd().
+ */
+void rscan::notify() {
+   uint64_t one = 1;
+   (void) !write(eventFd, &one, sizeof one);
+}
+
+/**
+ * @method classify
+ * Works out what an entry is, calling fstatat() only if d_type doesn't
+ * already say.  Also for checking a single name (e.g. one that just
+ * appeared) with DT_UNKNOWN.
+ * @param {const int} directoryFd - the directory it's in, or AT_FDCWD.
+ * @param {const char*} name - the entry's name.
+ * @param {const unsigned char} type - its d_type, or DT_UNKNOWN.
+ * @param {const bool} directories - whether directories are listed.
+ * @returns {uint16_t} RI_ flags, or RSCAN_SKIP to leave the entry out
+ * (including if it doesn't exist).
+ */
+uint16_t rscan::classify(const int directoryFd, const char* name, const unsigned char type, const bool directories) {
+   const uint16_t skip = RSCAN_SKIP;
+
+   if (type == DT_DIR) {
+      return directories ? RI_DIRECTORY : skip;
+   }
+   if (type != DT_REG && type != DT_LNK && type != DT_UNKNOWN) {
+      // devices, fifos, sockets
+      return skip;
+   }
+
+   // follows symlinks, like filesystem::status()
+   struct stat info;
+   if (fstatat(directoryFd, name, &info, 0) < 0) {
+      return skip;
+   }
+   if (S_ISDIR(info.st_mode)) {
+      return directories ? RI_DIRECTORY : skip;
+   }
+   if (!S_ISREG(info.st_mode)) {
+      return skip;
+   }
+   return (info.st_mode & S_IXOTH) ? RI_EXECUTABLE : RI_NONE;
+}
+
+/**
+ * @private
+ * @method work
+ * One worker: reads a buffer of entries, classifies them, queues the
+ * batch, and repeats until the directory runs out.
+ */
+void rscan::work() {
+   vector<char> buffer(bufferSize);
+
+   while (!stopping) {
+      long length;
+      {
+         lock_guard<mutex> guard(readLock);
+         if (exhausted) {
+            break;
+         }
+         length = syscall(SYS_getdents64, directoryFd, buffer.data(), buffer.size());
+         if (length <= 0) {
+            if (length < 0) {
+               error = errno;
+            }
+            exhausted = true;
+            break;
+         }
+      }
+
+      ritems batch;
+      for (long offset = 0; offset < length && !stopping; ) {
+         const rawDirent* entry = (const rawDirent*) (buffer.data() + offset);
+         offset += entry->d_reclen;
+
+         const char* name = entry->d_name;
+         if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+         }
+         uint16_t flags = classify(directoryFd, name, entry->d_type, directories);
+         if (flags != RSCAN_SKIP) {
+            batch.push_back(name, flags);
+         }
+      }
+
+      if (!batch.empty()) {
+         lock_guard<mutex> guard(resultLock);
+         ready.push_back(move(batch));
+      }
+      notify();
+   }
+
+   // the last worker out says so
+   if (--running == 0) {
+      notify();
+   }
+}
+
+#endif
@@ -0,0 +1,551 @@
+/*
+ * Class: rscreen
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ * Author: Renee Waverly Sonntag
+ *
+ * Description:
+ *
+ *      Wraps around an rterm and keeps two grids of cells: the back buffer
+ *      that the program draws into, and the front buffer that mirrors what
+ *      the terminal is currently showing.  present() compares the two and
+ *      only sends the cells that changed, reaching each one with whichever
+ *      cursor motion costs the fewest bytes.
+ *
+ *      Over a 9600 baud serial console this is the difference between
+ *      repainting a whole screen per keystroke and sending a few dozen bytes.
+ */
+
+#ifndef RSCREEN_H
+#define RSCREEN_H
+
+#include <string>
+#include <vector>
+#include <limits.h>
+#include <string.h>
+
+#include "rterm.h"
+#include "rutf8.h"
+
+using namespace std;
+
+/*
+ * Cell attributes, combine with |
+ */
+#define RS_NORMAL 0
+#define RS_REVERSE 1
+#define RS_BOLD 2
+#define RS_UNDERLINE 4
+
+class rscreen {
+   private:
+      struct cell {
+         char glyph[8];       // UTF-8 bytes, not NUL-terminated
+         unsigned char length; // number of bytes in glyph
+         unsigned char width;  // columns used, 0 for the right half of a wide glyph
+         unsigned char attr;
+
+         bool operator==(const cell& other) const {
+            return memcmp(this, &other, sizeof(cell)) == 0;
+         }
+         bool operator!=(const cell& other) const {
+            return !(*this == other);
+         }
+      };
+
+      rterm* rt;
+
+      vector<cell> back;
+      vector<cell> front;
+      bool cleared;
+
+      // lines written to since the last present(); only these are compared
+      vector<bool> dirty;
+
+      // where the terminal's cursor and attributes are right now;
+      // a line of -1 means unknown
+      long cursorLine;
+      long cursorCol;
+      unsigned char currentAttr;
+
+      // where the cursor should be left when present() finishes
+      size_t restLine;
+      size_t restCol;
+
+      rparm pHorizontal;
+      rparm pRight;
+      rparm pLeft;
+      rparm pDown;
+      rparm pUp;
+      string sCarriageReturn;
+      string sLeft;
+      string sReverse;
+      string sBold;
+      string sUnderline;
+      string sResetAttributes;
+
+      size_t emitted;
+
+      static cell blank();
+      void send(const char*, const size_t);
+      void send(const string&);
+      void emitAttr(unsigned char);
+      void emitMove(size_t, size_t);
+      void emitCell(const cell&);
+
+   public:
+      size_t lines;
+      size_t cols;
+
+      // counts how many times the back buffer has been blanked (clear()
+      // or resize()), so callers can tell when they need to redraw fully
+      unsigned long generation;
+
+      rscreen(rterm*);
+
+      void resize(const size_t, const size_t);
+      void clear();
+      void invalidate();
+      void forgetCursor();
+
+      size_t put(const size_t, const size_t, const string&, const unsigned char = RS_NORMAL);
+      size_t fill(const size_t, const size_t, const size_t, const unsigned char = RS_NORMAL);
+      void attribute(const size_t, const size_t, const size_t, const unsigned char);
+      void setCursor(const size_t, const size_t);
+
+      size_t present();
+};
+
+/**
+ * @constructs rscreen
+ * @param {rterm*} newrt - the rterm object to reference for terminal manip.
+ */
+rscreen::rscreen(rterm* newrt) {
+   rt = newrt;
+
+   pHorizontal.compile(rt->info.getString(TI_HPA));
+   pRight.compile(rt->info.getString(TI_CUF));
+   pLeft.compile(rt->info.getString(TI_CUB));
+   pDown.compile(rt->info.getString(TI_CUD));
+   pUp.compile(rt->info.getString(TI_CUU));
+   sCarriageReturn = rt->info.getString(TI_CR);
+   sLeft = rt->info.getString(TI_CUB1);
+   sReverse = rt->info.getString(TI_REV);
+   sBold = rt->info.getString(TI_BOLD);
+   sUnderline = rt->info.getString(TI_SMUL);
+   sResetAttributes = rt->info.getString(TI_SGR0);
+
+   restLine = 0;
+   restCol = 0;
+   generation = 0;
+   resize(rt->lines, rt->cols);
+}
+
+/**
+ * @private
+ * @method blank
+ * @returns {cell} a space with no attributes.
+ */
+rscreen::cell rscreen::blank() {
+   cell c;
+   memset(&c, 0, sizeof c);
+   c.glyph[0] = ' ';
+   c.length = 1;
+   c.width = 1;
+   return c;
+}
+
+/**
+ * @method resize
+ * Changes the size of both buffers.  The back buffer is cleared and the
+ * whole terminal will be repainted on the next present().
+ * @param {const size_t} newLines - the number of lines.
+ * @param {const size_t} newCols - the number of columns.
+ */
+void rscreen::resize(const size_t newLines, const size_t newCols) {
+   lines = newLines;
+   cols = newCols;
+   back.assign(lines * cols, blank());
+   generation++;
+   invalidate();
+}
+
+/**
+ * @method clear
+ * Blanks the back buffer.  Nothing is sent until present().
+ */
+void rscreen::clear() {
+   back.assign(lines * cols, blank());
+   dirty.assign(lines, true);
+   generation++;
+}
+
+/**
+ * @method invalidate
+ * Forgets what the terminal is showing (e.g. after another program used
+ * it).  The next present() clears the terminal and sends every non-blank
+ * cell.
+ */
+void rscreen::invalidate() {
+   front.assign(lines * cols, blank());
+   dirty.assign(lines, true);
+   cleared = true;
+   cursorLine = -1;
+   cursorCol = -1;
+   currentAttr = RS_NORMAL;
+}
+
+/**
+ * @method forgetCursor
+ * For when the terminal still shows what it did (e.g. back from the
+ * alternate screen) but the cursor and attributes may have been changed.
+ * The next present() positions the cursor absolutely and resets the
+ * attributes before sending anything.
+ */
+void rscreen::forgetCursor() {
+   cursorLine = -1;
+   cursorCol = -1;
+   currentAttr = UCHAR_MAX;
+}
+
+/**
+ * @method put
+ * Writes text into the back buffer, clipped at the right edge.
+ * Wide characters take two cells and combining marks join the cell
+ * before them (see rutf8.h for the widths).
+ * @param {const size_t} line - the line to write on.
+ * @param {const size_t} col - the column to start at.
+ * @param {const string&} text - UTF-8 text; control characters and invalid
+ * bytes show as '?'.
+ * @param {const unsigned char} attr - RS_ attributes for the text.
+ * @returns {size_t} the column after the last one written.
+ */
+size_t rscreen::put(const size_t line, const size_t col, const string& text, const unsigned char attr) {
+   if (line >= lines) {
+      return col;
+   }
+
+   cell* row = &back[line * cols];
+   dirty[line] = true;
+   size_t at = col;
+   size_t i = 0;
+   while (i < text.length() && at < cols) {
+      size_t start = i;
+      char32_t cp = decode_utf8(text.data(), text.length(), i);
+      size_t width = width_utf8(cp);
+
+      if (width == 0) {
+         // a combining mark rides along with the cell before it
+         if (at > col) {
+            size_t base = at - 1;
+            while (base > 0 && row[base].width == 0) {
+               base--;
+            }
+            if (row[base].length + (i - start) <= sizeof row[base].glyph) {
+               memcpy(row[base].glyph + row[base].length, text.data() + start, i - start);
+               row[base].length += i - start;
+            }
+         }
+         continue;
+      }
+
+      // overwriting either half of a wide glyph blanks the other half
+      if (row[at].width == 0 && at > 0) {
+         row[at - 1] = blank();
+         row[at - 1].attr = attr;
+      }
+      if (width == 2 && at + 1 >= cols) {
+         // no room for both halves
+         row[at] = blank();
+         row[at].attr = attr;
+         at++;
+         break;
+      }
+      size_t end = at + width;
+      if (end < cols && row[end].width == 0) {
+         row[end] = blank();
+         row[end].attr = attr;
+      }
+
+      cell& c = row[at];
+      memset(&c, 0, sizeof c);
+      if (cp < 0x20 || cp == 0x7F || (cp == RUTF8_REPLACEMENT && i - start == 1)) {
+         // control characters and invalid bytes
+         c.glyph[0] = '?';
+         c.length = 1;
+      } else {
+         memcpy(c.glyph, text.data() + start, i - start);
+         c.length = i - start;
+      }
+      c.width = width;
+      c.attr = attr;
+
+      if (width == 2) {
+         cell& right = row[at + 1];
+         memset(&right, 0, sizeof right);
+         right.attr = attr;
+      }
+      at = end;
+   }
+   return at;
+}
+
+/**
+ * @method fill
+ * Writes spaces into the back buffer, clipped at the right edge.
+ * @param {const size_t} line - the line to write on.
+ * @param {const size_t} col - the column to start at.
+ * @param {const size_t} count - how many columns to blank.
+ * @param {const unsigned char} attr - RS_ attributes for the spaces.
+ * @returns {size_t} the column after the last one written.
+ */
+size_t rscreen::fill(const size_t line, const size_t col, const size_t count, const unsigned char attr) {
+   if (line >= lines) {
+      return col;
+   }
+
+   cell* row = &back[line * cols];
+   dirty[line] = true;
+   size_t at = col;
+   cell c = blank();
+   c.attr = attr;
+
+   // don't leave half of a wide glyph behind on either side
+   if (count > 0 && at < cols && row[at].width == 0 && at > 0) {
+      row[at - 1] = c;
+   }
+   for (size_t i = 0; i < count && at < cols; i++, at++) {
+      row[at] = c;
+   }
+   if (count > 0 && at < cols && row[at].width == 0) {
+      row[at] = c;
+   }
+   return at;
+}
+
+/**
+ * @method attribute
+ * Changes the attributes of cells already in the back buffer, leaving
+ * their glyphs alone (e.g. to highlight part of something put()).
+ * @param {const size_t} line - the line to change.
+ * @param {const size_t} col - the first column to change.
+ * @param {const size_t} count - how many columns to change.
+ * @param {const unsigned char} attr - the RS_ attributes they get.
+ */
+void rscreen::attribute(const size_t line, const size_t col, const size_t count, const unsigned char attr) {
+   if (line >= lines) {
+      return;
+   }
+
+   cell* row = &back[line * cols];
+   dirty[line] = true;
+   for (size_t at = col; at < col + count && at < cols; at++) {
+      row[at].attr = attr;
+   }
+}
+
+/**
+ * @method setCursor
+ * Sets where the terminal cursor is left after present(), e.g. the
+ * end of an input prompt.
+ */
+void rscreen::setCursor(const size_t line, const size_t col) {
+   restLine = line;
+   restCol = col;
+}
+
+/**
+ * @private
+ * @method send
+ * Appends to the rterm's output buffer, counting the bytes.
+ */
+void rscreen::send(const char* text, const size_t length) {
+   emitted += length;
+   rt->write(text, length);
+}
+
+/**
+ * @private
+ * @method send
+ * @see send
+ */
+void rscreen::send(const string& text) {
+   send(text.data(), text.length());
+}
+
+/**
+ * @private
+ * @method emitAttr
+ * Switches the terminal to the given attributes if it isn't already.
+ */
+void rscreen::emitAttr(unsigned char attr) {
+   if (attr == currentAttr) {
+      return;
+   }
+   send(sResetAttributes);
+   if (attr & RS_REVERSE) send(sReverse);
+   if (attr & RS_BOLD) send(sBold);
+   if (attr & RS_UNDERLINE) send(sUnderline);
+   currentAttr = attr;
+}
+
+/**
+ * @private
+ * @method emitMove
+ * Moves the terminal cursor using the shortest of: absolute addressing,
+ * carriage return, horizontal addressing, relative motion, backspaces,
+ * or simply re-sending the unchanged cells in between.
+ */
+void rscreen::emitMove(size_t line, size_t col) {
+   if (cursorLine == (long) line && cursorCol == (long) col) {
+      return;
+   }
+
+   char best[64];
+   char candidate[64];
+   size_t bestLength = rt->formatMoveCursor(best, sizeof best, line, col);
+   auto consider = [&](size_t length) {
+      if (length > 0 && length < bestLength) {
+         memcpy(best, candidate, length);
+         bestLength = length;
+      }
+   };
+
+   if (cursorLine >= 0 && cursorCol >= 0 && cursorCol < (long) cols) {
+      size_t fromCol = cursorCol;
+
+      if (cursorLine == (long) line) {
+         if (col == 0 && !sCarriageReturn.empty() && sCarriageReturn.length() < sizeof candidate) {
+            memcpy(candidate, sCarriageReturn.data(), sCarriageReturn.length());
+            consider(sCarriageReturn.length());
+         }
+         if (!pHorizontal.empty()) {
+            consider(pHorizontal.format(candidate, sizeof candidate, col));
+         }
+
+         if (col > fromCol) {
+            if (!pRight.empty()) {
+               consider(pRight.format(candidate, sizeof candidate, col - fromCol));
+            }
+
+            // re-sending what's already there only works if it's plain
+            // single-width glyphs in the attributes we're already using
+            size_t length = 0;
+            bool usable = true;
+            for (size_t i = fromCol; i < col && usable; i++) {
+               const cell& c = front[line * cols + i];
+               if (c.width != 1 || c.attr != currentAttr || length + c.length > bestLength) {
+                  usable = false;
+               } else {
+                  memcpy(candidate + length, c.glyph, c.length);
+                  length += c.length;
+               }
+            }
+            if (usable) {
+               consider(length);
+            }
+         } else {
+            if (!pLeft.empty()) {
+               consider(pLeft.format(candidate, sizeof candidate, fromCol - col));
+            }
+            size_t steps = fromCol - col;
+            if (!sLeft.empty() && steps * sLeft.length() < bestLength) {
+               for (size_t i = 0; i < steps; i++) {
+                  memcpy(candidate + i * sLeft.length(), sLeft.data(), sLeft.length());
+               }
+               consider(steps * sLeft.length());
+            }
+         }
+      } else if (col == fromCol) {
+         if ((long) line > cursorLine && !pDown.empty()) {
+            consider(pDown.format(candidate, sizeof candidate, line - cursorLine));
+         } else if ((long) line < cursorLine && !pUp.empty()) {
+            consider(pUp.format(candidate, sizeof candidate, cursorLine - line));
+         }
+      }
+   }
+
+   send(best, bestLength);
+   cursorLine = line;
+   cursorCol = col;
+}
+
+/**
+ * @private
+ * @method emitCell
+ * Sends one cell at the cursor and advances the cursor past it.
+ */
+void rscreen::emitCell(const cell& c) {
+   emitAttr(c.attr);
+   send(c.glyph, c.length);
+   cursorCol += c.width;
+   if (cursorCol >= (long) cols) {
+      // the terminal may or may not have wrapped already
+      cursorLine = -1;
+      cursorCol = -1;
+   }
+}
+
+/**
+ * @method present
+ * Sends every cell that differs between the back and front buffers,
+ * then leaves the cursor where setCursor() asked.  Only lines that have
+ * been written to since the last present() are compared.
+ * Everything goes out as one rterm frame.
+ * @returns {size_t} the number of bytes sent to the terminal.
+ */
+size_t rscreen::present() {
+   emitted = 0;
+   rt->beginFrame();
+
+   if (cleared) {
+      emitAttr(RS_NORMAL);
+      send(rt->getClear());
+      cursorLine = 0;
+      cursorCol = 0;
+      cleared = false;
+   }
+
+   for (size_t line = 0; line < lines; line++) {
+      if (!dirty[line]) {
+         continue;
+      }
+      dirty[line] = false;
+
+      for (size_t col = 0; col < cols; col++) {
+         size_t index = line * cols + col;
+         if (back[index] == front[index]) {
+            continue;
+         }
+
+         // the right half of a wide glyph is sent with its left half
+         size_t start = col;
+         while (start > 0 && back[line * cols + start].width == 0) {
+            start--;
+         }
+         size_t end = col;
+         while (end + 1 < cols && back[line * cols + end + 1].width == 0) {
+            end++;
+         }
+
+         emitMove(line, start);
+         for (size_t i = start; i <= end; i++) {
+            if (back[line * cols + i].width > 0) {
+               emitCell(back[line * cols + i]);
+            }
+            front[line * cols + i] = back[line * cols + i];
+         }
+         col = end;
+      }
+   }
+
+   emitAttr(RS_NORMAL);
+   if (restLine < lines && restCol < cols) {
+      emitMove(restLine, restCol);
+   }
+
+   rt->endFrame();
+   return emitted;
+}
+
+#endif
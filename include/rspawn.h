@@ -0,0 +1,156 @@
+/*
+ * Class: rspawn
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ * Author: Renee Waverly Sonntag
+ *
+ * Description:
+ *
+ *      Starts child programs with posix_spawn() instead of fork() + exec.
+ *
+ *      fork() copies the parent's page tables (and marks every page
+ *      copy-on-write) only for the child to throw them away at exec, and
+ *      a forked child of a threaded process inherits whatever locks the
+ *      other threads happened to hold.  glibc and musl implement
+ *      posix_spawn() with a vfork-style clone that shares the parent's
+ *      memory and runs nothing but the descriptor and signal setup before
+ *      exec, so neither problem comes up and it costs the same however
+ *      big the parent is.
+ *
+ *      They also report a failed exec (no such program, not executable)
+ *      as start()'s result instead of as a child that exits with 127:
+ *      the parent doesn't resume until the child has exec()ed or given
+ *      up.  This is what the usual fork() trick of a close-on-exec pipe
+ *      the child writes errno to does, without the pipe.
+ *
+ *      Children get the signal mask the process had before an rloop
+ *      blocked its signals (see rloop::childSignalMask), and any
+ *      redirect()ed descriptors.  Everything else menu and midi open is
+ *      close-on-exec already.  Collecting the exit status is left to
+ *      rloop::watchChild.
+ */
+
+#ifndef RSPAWN_H
+#define RSPAWN_H
+
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+extern char** environ;
+
+class rspawn {
+   private:
+      posix_spawnattr_t attributes;
+      posix_spawn_file_actions_t actions;
+
+      rspawn(const rspawn&) = delete;
+      rspawn& operator=(const rspawn&) = delete;
+
+   public:
+      // errno from the last start(), 0 if none
+      int error;
+
+      rspawn();
+      ~rspawn();
+
+      void setSignalMask(const sigset_t&);
+      bool redirect(const int, const char*, const int);
+
+      pid_t start(const vector<string>&);
+
+      static string describe(const int);
+};
+
+/**
+ * @constructs rspawn
+ * Children start with the same signal mask and descriptors as this
+ * process until told otherwise.
+ */
+rspawn::rspawn() {
+   error = 0;
+   posix_spawnattr_init(&attributes);
+   posix_spawn_file_actions_init(&actions);
+}
+
+/**
+ * @destructs rspawn
+ */
+rspawn::~rspawn() {
+   posix_spawn_file_actions_destroy(&actions);
+   posix_spawnattr_destroy(&attributes);
+}
+
+/**
+ * @method setSignalMask
+ * Sets the signal mask children start with.
+ * @param {const sigset_t&} mask - e.g. from rloop::childSignalMask().
+ */
+void rspawn::setSignalMask(const sigset_t& mask) {
+   posix_spawnattr_setsigmask(&attributes, &mask);
+   posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+}
+
+/**
+ * @method redirect
+ * Opens a file as one of the children's descriptors, e.g. /dev/null as
+ * stdin for a program that shouldn't read the keyboard.
+ * @param {const int} fd - the descriptor in the child.
+ * @param {const char*} path - the file.
+ * @param {const int} flags - open() flags.
+ * @returns {bool} false if it couldn't be arranged.
+ */
+bool rspawn::redirect(const int fd, const char* path, const int flags) {
+   return posix_spawn_file_actions_addopen(&actions, fd, path, flags, 0666) == 0;
+}
+
+/**
+ * @method start
+ * Runs a program, searching PATH for it like execvp().
+ * @param {const vector<string>&} arguments - the program's name, then its
+ * arguments.
+ * @returns {pid_t} the child, or -1 if it couldn't be started (see error).
+ */
+pid_t rspawn::start(const vector<string>& arguments) {
+   if (arguments.empty()) {
+      error = EINVAL;
+      return -1;
+   }
+
+   vector<char*> argv;
+   argv.reserve(arguments.size() + 1);
+   for (const string& argument : arguments) {
+      argv.push_back(const_cast<char*>(argument.c_str()));
+   }
+   argv.push_back(NULL);
+
+   pid_t pid;
+   error = posix_spawnp(&pid, argv[0], &actions, &attributes, argv.data(), environ);
+   return (error == 0) ? pid : -1;
+}
+
+/**
+ * @method describe
+ * @param {const int} status - a waitpid() status.
+ * @returns {string} how the child ended, e.g. "exited with 1".
+ */
+string rspawn::describe(const int status) {
+   if (WIFEXITED(status)) {
+      return "exited with " + to_string(WEXITSTATUS(status));
+   }
+   if (WIFSIGNALED(status)) {
+      const char* name = strsignal(WTERMSIG(status));
+      return string("killed by ") + (name ? name : to_string(WTERMSIG(status)).c_str());
+   }
+   return "stopped";
+}
+
+#endif
@@ -7,8 +7,13 @@
  * Description:
  *
  *      This class provides a simple interface for manipulating the terminal.
- *      It uses terminfo/termcap to fetch the required sequences on initialization,
- *      but makes no further shell invocations.
+ *      It reads the terminfo database to fetch the required sequences on
+ *      initialization, and makes no shell invocations of its own.
+ *
+ *      Output is collected in a buffer and handed to the tty with a single
+ *      write() per frame (see beginFrame/endFrame), instead of one syscall
+ *      per << as cout with unitbuf used to do.  Anything written outside of
+ *      a frame is flushed straight away.
  *
  *      Ideally I would have used ncurses or a similar implementation,
  *      but I was borrowing a Raspberry Pi which did not have the development
@@ -24,76 +29,141 @@
 #include <iomanip>
 #include <stdio.h>
 #include <stdexcept>
-#include <stack>
 #include <sstream>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+
+// terminfo database
+#include "rterminfo.h"
+
+// parameterized capabilities
+#include "rparm.h"
 
 using namespace std;
 
+/*
+ * Output counters, for checking how much a frame costs.
+ */
+struct rtermStats {
+   size_t bytes;
+   size_t syscalls;
+};
+
 class rterm {
    private:
       string sClear;
-      string sMoveCursor;
       string sReverse;
       string sResetAttributes;
       string sSaveCursor;
       string sRestoreCursor;
-      string sChangeScroll;
       string sResetTerminal;
+      string sEnterAlternate;
+      string sLeaveAlternate;
       
+      rparm pMoveCursor;
+      rparm pChangeScroll;
+
+      string outputBuffer;
+      int frameDepth;
+
+      void output(const char*, const size_t);
+      void output(const string&);
+
+      static int resizePipe[2];
+      static void resizeSignalHandler(int);
+
       string ToHex(const string&, const bool); /* for debugging */
-      string processUnescapedSequence(const string, const int, const int);
       
    public:
+      rterminfo info;
+
       size_t cols;
       size_t lines;
+
+      rtermStats lastFrame;
+      rtermStats totals;
       
       rterm();
       string exec(const char*);
       
       bool updateDimensions();
+      int watchResize();
+      bool checkResize();
+
+      void beginFrame();
+      void endFrame();
+      void flush();
+      void write(const string&);
+      void write(const char*, const size_t);
+
       void clear();
       void moveCursor(const int, const int);
+      size_t formatMoveCursor(char*, const size_t, const int, const int);
       void reverse();
       void resetAttributes();
       void saveCursor();
       void restoreCursor();
       void changeScrollRegion(const int, const int);
       void resetTerminal();
+      bool enterAlternateScreen();
+      bool leaveAlternateScreen();
       
-      string getReverse();
-      string getResetAttributes();
-      string getSaveCursor();
-      string getRestoreCursor();
+      const string& getClear();
+      const string& getReverse();
+      const string& getResetAttributes();
+      const string& getSaveCursor();
+      const string& getRestoreCursor();
 };
 
 /**
  * @constructs rterm
  * Gets the necessary control sequences and the dimensions of the terminal.
+ * Everything comes out of the terminfo database in one pass (see rterminfo.h),
+ * so no shells are spawned.
  */
 rterm::rterm() {
+   frameDepth = 0;
+   lastFrame = {0, 0};
+   totals = {0, 0};
+
    // Get the control sequence for clear
-   sClear = exec("tput clear");
+   sClear = info.getString(TI_CLEAR);
    
-   // Get the unescaped control sequence for moving the cursor
-   sMoveCursor = exec("tput cup");
+   // Compile the parameterized control sequence for moving the cursor
+   pMoveCursor.compile(info.getString(TI_CUP));
    
    // Get the control sequence for reverse color
-   sReverse = exec("tput rev");
+   sReverse = info.getString(TI_REV);
    
    // Get the control sequence for reset attributes
-   sResetAttributes = exec("tput sgr0");
+   sResetAttributes = info.getString(TI_SGR0);
 
    // Get the control sequence for save cursor
-   sSaveCursor = exec("tput sc");
+   sSaveCursor = info.getString(TI_SC);
 
    // Get the control sequence for restore cursor
-   sRestoreCursor = exec("tput rc");
+   sRestoreCursor = info.getString(TI_RC);
 
-   // Get the unescaped control sequence for changing the scroll region
-   sChangeScroll = exec("tput csr");
+   // Compile the parameterized control sequence for changing the scroll region
+   pChangeScroll.compile(info.getString(TI_CSR));
 
    // Get the control sequence for resetting the terminal
-   sResetTerminal = exec("tput reset");
+   // (tput reset sends the reset strings, or the init strings if there are none)
+   sResetTerminal = info.getString(TI_RS1) + info.getString(TI_RS2) + info.getString(TI_RS3);
+   if (sResetTerminal.empty()) {
+      sResetTerminal = info.getString(TI_IS1) + info.getString(TI_IS2) + info.getString(TI_IS3);
+   }
+
+   // Get the control sequences for switching to and from the alternate
+   // screen (the linux console has none)
+   sEnterAlternate = info.getString(TI_SMCUP);
+   sLeaveAlternate = info.getString(TI_RMCUP);
    
    // Get the dimensions of the terminal
    updateDimensions();
@@ -125,20 +195,200 @@ string rterm::exec(const char* cmd) {
 
 /**
  * @method updateDimensions
- * Reaches out to terminfo to get the dimensions of the terminal.
+ * Asks the tty driver for the dimensions of the terminal, the same way
+ * tput does.  Falls back to $COLUMNS/$LINES and then to terminfo when
+ * the output isn't a terminal.
  * @returns {bool} true if success, false if failure.
  */
 bool rterm::updateDimensions() {
-   try {
-      string sCols = exec("tput cols");
-      string sLines = exec("tput lines");
-      
-      cols = stoi(sCols);
-      lines = stoi(sLines);
-   } catch(...) {
-      return false;
+   struct winsize ws;
+   if ((ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 || ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) == 0)
+         && ws.ws_col > 0 && ws.ws_row > 0) {
+      cols = ws.ws_col;
+      lines = ws.ws_row;
+      return true;
    }
-   return true;
+
+   const char* envCols = getenv("COLUMNS");
+   const char* envLines = getenv("LINES");
+   if (envCols && envLines && atoi(envCols) > 0 && atoi(envLines) > 0) {
+      cols = atoi(envCols);
+      lines = atoi(envLines);
+      return true;
+   }
+
+   if (info.getNumber(TI_COLS) > 0 && info.getNumber(TI_LINES) > 0) {
+      cols = info.getNumber(TI_COLS);
+      lines = info.getNumber(TI_LINES);
+      return true;
+   }
+   return false;
+}
+
+/*
+ * Self-pipe for SIGWINCH; the handler only writes a byte so it is
+ * async-signal-safe, and the read end can sit in a poll() set.
+ */
+int rterm::resizePipe[2] = {-1, -1};
+
+/**
+ * @private
+ * @method resizeSignalHandler
+ * SIGWINCH handler; wakes up whoever is polling resizeFd.
+ */
+void rterm::resizeSignalHandler(int) {
+   int savedErrno = errno;
+   char wake = 0;
+   if (::write(resizePipe[1], &wake, 1) < 0) {
+      // pipe already full, a wakeup is pending anyway
+   }
+   errno = savedErrno;
+}
+
+/**
+ * @method watchResize
+ * Starts listening for SIGWINCH.  The returned descriptor becomes
+ * readable whenever the terminal may have been resized; call
+ * checkResize() when it does.
+ * @returns {int} the descriptor to poll, or -1 on failure.
+ */
+int rterm::watchResize() {
+   if (resizePipe[0] >= 0) {
+      return resizePipe[0];
+   }
+
+   if (pipe(resizePipe) < 0) {
+      return -1;
+   }
+   for (int fd : resizePipe) {
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+   }
+
+   struct sigaction action;
+   memset(&action, 0, sizeof action);
+   action.sa_handler = resizeSignalHandler;
+   action.sa_flags = SA_RESTART;
+   sigemptyset(&action.sa_mask);
+   sigaction(SIGWINCH, &action, NULL);
+
+   return resizePipe[0];
+}
+
+/**
+ * @method checkResize
+ * Drains pending resize notifications and re-reads the dimensions.
+ * @returns {bool} true if cols or lines actually changed.
+ */
+bool rterm::checkResize() {
+   char drain[64];
+   if (resizePipe[0] >= 0) {
+      while (read(resizePipe[0], drain, sizeof drain) > 0) {
+      }
+   }
+
+   size_t oldCols = cols;
+   size_t oldLines = lines;
+   updateDimensions();
+   return (cols != oldCols) || (lines != oldLines);
+}
+
+/**
+ * @method beginFrame
+ * Starts collecting output.  Nothing reaches the terminal until the
+ * matching endFrame().  Frames nest; only the outermost one flushes.
+ */
+void rterm::beginFrame() {
+   frameDepth++;
+}
+
+/**
+ * @method endFrame
+ * Ends a frame started by beginFrame(), writing everything collected
+ * to the terminal if this was the outermost frame.
+ */
+void rterm::endFrame() {
+   if (frameDepth > 0) {
+      frameDepth--;
+   }
+   if (frameDepth == 0) {
+      flush();
+   }
+}
+
+/**
+ * @method flush
+ * Writes everything collected so far to the terminal, normally with a
+ * single write().  Updates lastFrame and totals.
+ */
+void rterm::flush() {
+   if (outputBuffer.empty()) {
+      return;
+   }
+
+   size_t written = 0;
+   size_t syscalls = 0;
+   while (written < outputBuffer.length()) {
+      ssize_t result = ::write(STDOUT_FILENO, outputBuffer.data() + written, outputBuffer.length() - written);
+      syscalls++;
+      if (result > 0) {
+         written += result;
+      } else if (result < 0 && errno == EINTR) {
+         continue;
+      } else if (result < 0 && errno == EAGAIN) {
+         // non-blocking tty that's full, wait until it drains
+         struct pollfd pfd = {STDOUT_FILENO, POLLOUT, 0};
+         poll(&pfd, 1, -1);
+      } else {
+         // nowhere to put it (e.g. the terminal went away)
+         break;
+      }
+   }
+
+   lastFrame = {outputBuffer.length(), syscalls};
+   totals.bytes += outputBuffer.length();
+   totals.syscalls += syscalls;
+   outputBuffer.clear();
+}
+
+/**
+ * @method write
+ * Writes text to the terminal (or to the current frame).
+ * @param {const string&} text - the text to write.
+ */
+void rterm::write(const string& text) {
+   output(text);
+}
+
+/**
+ * @method write
+ * Writes text to the terminal (or to the current frame).
+ * @param {const char*} text - the text to write.
+ * @param {const size_t} length - the number of bytes to write.
+ */
+void rterm::write(const char* text, const size_t length) {
+   output(text, length);
+}
+
+/**
+ * @private
+ * @method output
+ * Appends to the output buffer and flushes it when no frame is open.
+ */
+void rterm::output(const char* text, const size_t length) {
+   outputBuffer.append(text, length);
+   if (frameDepth == 0) {
+      flush();
+   }
+}
+
+/**
+ * @private
+ * @method output
+ * @see output
+ */
+void rterm::output(const string& text) {
+   output(text.data(), text.length());
 }
 
 /**
@@ -149,51 +399,24 @@ bool rterm::updateDimensions() {
  * @todo Check for valid coordinates given current terminal dimensions.
  */
 void rterm::moveCursor(const int line, const int col) {
-   cout << processUnescapedSequence(sMoveCursor, line, col);
+   char sequence[32];
+   size_t length = pMoveCursor.format(sequence, sizeof sequence, line, col);
+   output(sequence, length);
 }
 
 /**
- * @private
- * @method processUnescapedSequence
- * Processes the sequence with the provided parameters
- * @param {const string} originalSequence - the sequence to process
- * @param {const int} param1 - the first parameter
- * @param {const int} param2 - the second parameter
- */
-string rterm::processUnescapedSequence(const string originalSequence, const int param1, const int param2) {
-   string swap = originalSequence;
-   int nParam1 = param1;
-   int nParam2 = param2;
-   
-   // Check for flag to increment numeric parameters by 1.
-   size_t i = swap.find("%i");
-   if (i != string::npos) {
-      swap.erase(i,2);
-      nParam1 += 1;
-      nParam2 += 1;
-   }
-   
-   // Filter through parameters and printing them
-   stack<int> pStack;
-   size_t nextP = swap.find("%p");
-   size_t nextD = swap.find("%d");
-   while ((nextP != string::npos) || (nextD != string::npos)) {
-      if (nextP < nextD) {
-         if (swap[nextP + 2] == '1') {
-            pStack.push(nParam1);
-         } else {
-            pStack.push(nParam2);
-         }
-         swap.erase(nextP, 3);
-      } else {
-         swap.replace(nextD, 2, to_string(pStack.top()));
-         pStack.pop();
-      }
-      
-      nextP = swap.find("%p");
-      nextD = swap.find("%d");
-   }
-   return swap;
+ * @method formatMoveCursor
+ * @see moveCursor
+ * Instead of executing the move cursor control sequence, this method writes
+ * it into the provided buffer (NUL-terminated, truncated to fit).
+ * @param {char*} buffer - where to write the sequence.
+ * @param {const size_t} size - the size of the buffer.
+ * @param {const int} line - the line to move the cursor to.
+ * @param {const int} col - the column to move the cursor to.
+ * @returns {size_t} the length of the sequence.
+ */
+size_t rterm::formatMoveCursor(char* buffer, const size_t size, const int line, const int col) {
+   return pMoveCursor.format(buffer, size, line, col);
 }
 
 /**
@@ -201,7 +424,7 @@ string rterm::processUnescapedSequence(const string originalSequence, const int
  * Clear the screen.
  */
 void rterm::clear() {
-   cout << sClear;
+   output(sClear);
 }
 
 /**
@@ -212,7 +435,7 @@ void rterm::clear() {
  * @see resetAttributes for undoing this command.
  */
 void rterm::reverse() {
-   cout << sReverse;
+   output(sReverse);
 }
 
 /**
@@ -221,7 +444,7 @@ void rterm::reverse() {
  * with terminal default attributes.
  */
 void rterm::resetAttributes() {
-   cout << sResetAttributes;
+   output(sResetAttributes);
 }
 
 /**
@@ -229,7 +452,7 @@ void rterm::resetAttributes() {
  * Saves the position of the cursor (nonstackable).
  */
 void rterm::saveCursor() {
-   cout << sSaveCursor;
+   output(sSaveCursor);
 }
 
 /**
@@ -237,7 +460,7 @@ void rterm::saveCursor() {
  * Restores the position of the cursor (nonstackable).
  */
 void rterm::restoreCursor() {
-   cout << sRestoreCursor;
+   output(sRestoreCursor);
 }
 
 /**
@@ -247,7 +470,9 @@ void rterm::restoreCursor() {
  * @param {const int} lastline - the last line to be in the scroll region
  */
 void rterm::changeScrollRegion(const int firstline, const int lastline) {
-   cout << processUnescapedSequence(sChangeScroll, firstline, lastline);
+   char sequence[32];
+   size_t length = pChangeScroll.format(sequence, sizeof sequence, firstline, lastline);
+   output(sequence, length);
 }
 
 /**
@@ -255,17 +480,57 @@ void rterm::changeScrollRegion(const int firstline, const int lastline) {
  * Resets the terminal to system defaults for all parameters.
  */
 void rterm::resetTerminal() {
-   cout << sResetTerminal;
+   output(sResetTerminal);
+}
+
+/**
+ * @method enterAlternateScreen
+ * Switches to the terminal's alternate screen and clears it, leaving
+ * what's on the normal screen to come back to, e.g. while another
+ * program runs.
+ * @returns {bool} false if the terminal has no alternate screen.
+ */
+bool rterm::enterAlternateScreen() {
+   if (sEnterAlternate.empty() || sLeaveAlternate.empty()) {
+      return false;
+   }
+   output(sEnterAlternate + sClear);
+   return true;
+}
+
+/**
+ * @method leaveAlternateScreen
+ * Switches back to the normal screen, which shows whatever it did before
+ * enterAlternateScreen().  The cursor may be anywhere.
+ * @returns {bool} false if the terminal has no alternate screen.
+ */
+bool rterm::leaveAlternateScreen() {
+   if (sEnterAlternate.empty() || sLeaveAlternate.empty()) {
+      return false;
+   }
+   output(sLeaveAlternate);
+   return true;
+}
+
+/**
+ * @method getClear
+ * @see clear
+ * Instead of executing the clear control sequence, this method gives it to
+ * you in string form.
+ * @returns {string} the control sequence for clearing the screen.
+ */
+const string& rterm::getClear() {
+   return sClear;
 }
 
 /**
  * @method getReverse
  * @see reverse
  * Instead of executing the reverse control sequence, this method gives it to
- * you in string form.  Useful for cout inlining of output manipulation.
+ * you in string form.  Useful for building output that is written in one go.
  * @returns {string} the control sequence for reversing colors.
  */
-string rterm::getReverse() {
+const string& rterm::getReverse() {
    return sReverse;
 }
 
@@ -273,10 +538,10 @@ string rterm::getReverse() {
  * @method getResetAttributes
  * @see resetAttributes
  * Instead of executing the reset attributes control sequence, this method gives
- * it to you in string form.  Useful for cout inlining of output manipulation.
+ * it to you in string form.  Useful for building output that is written in one go.
  * @returns {string} the control sequence for reseting attributes.
  */
-string rterm::getResetAttributes() {
+const string& rterm::getResetAttributes() {
    return sResetAttributes;
 }
 
@@ -284,10 +549,10 @@ string rterm::getResetAttributes() {
  * @method getSaveCursor
  * @see saveCursor
  * Instead of executing the save cursor control sequence, this method gives it
- * to you in string form.  Useful for cout inlining of output manipulation.
+ * to you in string form.  Useful for building output that is written in one go.
  * @returns {string} the control sequence for saving the cursor.
  */
-string rterm::getSaveCursor() {
+const string& rterm::getSaveCursor() {
    return sSaveCursor;
 }
 
@@ -295,10 +560,10 @@ string rterm::getSaveCursor() {
  * @method getRestoreCursor
  * @see restoreCursor
  * Instead of executing the restore cursor control sequence, this method gives
- * it to you in string form.  Useful for cout inlining of output manipulation.
+ * it to you in string form.  Useful for building output that is written in one go.
  * @returns {string} the control sequence for restoring the cursor.
  */
-string rterm::getRestoreCursor() {
+const string& rterm::getRestoreCursor() {
    return sRestoreCursor;
 }
 
@@ -0,0 +1,415 @@
+/*
+ * Class: rterminfo
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ * Author: Renee Waverly Sonntag
+ *
+ * Description:
+ *
+ *      Reads the compiled terminfo entry for a terminal straight out of the
+ *      terminfo database, the same files that tput and ncurses read.
+ *      Every capability is loaded in a single pass with no child processes,
+ *      which matters on a Pi Zero where each tput invocation costs a
+ *      fork/exec.
+ *
+ *      If no entry can be found (or the file is damaged) a small built-in
+ *      table for vt100, xterm and linux is used instead.
+ *
+ *      The binary layout is documented in term(5).  Both the legacy format
+ *      (16-bit numbers) and the extended number format (32-bit numbers) are
+ *      understood.  User-defined extended capabilities are ignored.
+ */
+
+#ifndef RTERMINFO_H
+#define RTERMINFO_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace std;
+
+/*
+ * Indices into the standard terminfo string table (see term.h).
+ * Only the capabilities used in this project are named here,
+ * but all of them are loaded.
+ */
+#define TI_CR 2
+#define TI_CSR 3
+#define TI_CLEAR 5
+#define TI_EL 6
+#define TI_ED 7
+#define TI_HPA 8
+#define TI_CUP 10
+#define TI_CUD1 11
+#define TI_HOME 12
+#define TI_CIVIS 13
+#define TI_CUB1 14
+#define TI_CNORM 16
+#define TI_CUF1 17
+#define TI_CUU1 19
+#define TI_BOLD 27
+#define TI_SMCUP 28
+#define TI_REV 34
+#define TI_SMUL 36
+#define TI_SGR0 39
+#define TI_RMCUP 40
+#define TI_IS1 48
+#define TI_IS2 49
+#define TI_IS3 50
+#define TI_KCUD1 61
+#define TI_KF1 66
+#define TI_KF10 67
+#define TI_KF2 68
+#define TI_KF3 69
+#define TI_KF4 70
+#define TI_KF5 71
+#define TI_KF6 72
+#define TI_KF7 73
+#define TI_KF8 74
+#define TI_KF9 75
+#define TI_KCUB1 79
+#define TI_KCUF1 83
+#define TI_KCUU1 87
+#define TI_CUD 107
+#define TI_CUB 111
+#define TI_CUF 112
+#define TI_CUU 114
+#define TI_RS1 122
+#define TI_RS2 123
+#define TI_RS3 124
+#define TI_RC 126
+#define TI_VPA 127
+#define TI_SC 128
+#define TI_KENT 165
+
+/*
+ * Indices into the standard terminfo number table.
+ */
+#define TI_COLS 0
+#define TI_LINES 2
+
+class rterminfo {
+   private:
+      vector<string> strings;
+      vector<int> numbers;
+
+      string readEntry(const string&);
+      bool parse(const string&);
+      bool loadBuiltin(const string&);
+
+   public:
+      string name;
+      bool builtin;
+
+      rterminfo();
+      rterminfo(const string&);
+
+      bool load(const string&);
+
+      const string& getString(const size_t) const;
+      int getNumber(const size_t) const;
+      bool hasString(const size_t) const;
+};
+
+/**
+ * @constructs rterminfo
+ * Loads the entry named by $TERM (or vt100 if unset).
+ */
+rterminfo::rterminfo() {
+   const char* term = getenv("TERM");
+   load((term && *term) ? term : "vt100");
+}
+
+/**
+ * @constructs rterminfo
+ * @param {const string&} term - the terminal name to load.
+ */
+rterminfo::rterminfo(const string& term) {
+   load(term);
+}
+
+/**
+ * @method load
+ * Loads the named terminal from the terminfo database, falling back to
+ * the built-in tables when it can't be found or parsed.
+ * @param {const string&} term - the terminal name to load.
+ * @returns {bool} true if a database entry was used, false if built-in.
+ */
+bool rterminfo::load(const string& term) {
+   name = term;
+   builtin = false;
+
+   if (parse(readEntry(term))) {
+      return true;
+   }
+
+   builtin = true;
+   loadBuiltin(term);
+   return false;
+}
+
+/**
+ * @private
+ * @method readEntry
+ * Searches the terminfo directories in the same order as ncurses and
+ * returns the raw contents of the first compiled entry found.
+ * @param {const string&} term - the terminal name to look up.
+ * @returns {string} the file contents, or an empty string if not found.
+ */
+string rterminfo::readEntry(const string& term) {
+   // don't allow the name to wander out of the database
+   if (term.empty() || term.find('/') != string::npos) {
+      return "";
+   }
+
+   vector<string> dirs;
+   const char* env = getenv("TERMINFO");
+   if (env && *env) {
+      dirs.push_back(env);
+   }
+   env = getenv("HOME");
+   if (env && *env) {
+      dirs.push_back(string(env) + "/.terminfo");
+   }
+   env = getenv("TERMINFO_DIRS");
+   if (env && *env) {
+      stringstream list(env);
+      string dir;
+      while (getline(list, dir, ':')) {
+         // an empty element means "the system default"
+         dirs.push_back(dir.empty() ? "/usr/share/terminfo" : dir);
+      }
+   }
+   dirs.push_back("/etc/terminfo");
+   dirs.push_back("/lib/terminfo");
+   dirs.push_back("/usr/share/terminfo");
+
+   // entries are filed under their first letter, or its hex code on
+   // filesystems that are case-insensitive
+   char hexdir[3];
+   snprintf(hexdir, sizeof hexdir, "%02x", (unsigned char) term[0]);
+
+   for (auto dir : dirs) {
+      for (auto subdir : {string(1, term[0]), string(hexdir)}) {
+         ifstream file(dir + "/" + subdir + "/" + term, ios::binary);
+         if (file) {
+            stringstream contents;
+            contents << file.rdbuf();
+            return contents.str();
+         }
+      }
+   }
+   return "";
+}
+
+/**
+ * @private
+ * @method parse
+ * Decodes a compiled terminfo entry.
+ * Padding specifications ($<...>) are stripped from the strings since
+ * nothing we talk to needs delay padding.
+ * @param {const string&} data - the raw file contents.
+ * @returns {bool} true if the entry was well formed.
+ */
+bool rterminfo::parse(const string& data) {
+   auto readShort = [&data](size_t at) -> int {
+      return (short) ((unsigned char) data[at] | ((unsigned char) data[at + 1] << 8));
+   };
+   auto readInt = [&data](size_t at) -> int {
+      return (int) ((unsigned char) data[at]
+         | ((unsigned char) data[at + 1] << 8)
+         | ((unsigned char) data[at + 2] << 16)
+         | ((unsigned)(unsigned char) data[at + 3] << 24));
+   };
+
+   if (data.length() < 12) {
+      return false;
+   }
+
+   int magic = readShort(0);
+   size_t numberWidth;
+   if (magic == 0432) {
+      numberWidth = 2;
+   } else if (magic == 01036) {
+      numberWidth = 4;
+   } else {
+      return false;
+   }
+
+   int nameSize = readShort(2);
+   int boolCount = readShort(4);
+   int numberCount = readShort(6);
+   int stringCount = readShort(8);
+   int tableSize = readShort(10);
+   if (nameSize < 0 || boolCount < 0 || numberCount < 0 || stringCount < 0 || tableSize < 0) {
+      return false;
+   }
+
+   size_t at = 12 + nameSize + boolCount;
+   // numbers start on an even byte
+   if (at % 2) {
+      at++;
+   }
+
+   size_t stringOffsets = at + numberCount * numberWidth;
+   size_t stringTable = stringOffsets + stringCount * 2;
+   if (stringTable + tableSize > data.length()) {
+      return false;
+   }
+
+   numbers.assign(numberCount, -1);
+   for (int i = 0; i < numberCount; i++) {
+      numbers[i] = (numberWidth == 2) ? readShort(at + i * 2) : readInt(at + i * 4);
+   }
+
+   strings.assign(stringCount, "");
+   for (int i = 0; i < stringCount; i++) {
+      int offset = readShort(stringOffsets + i * 2);
+      if (offset < 0 || offset >= tableSize) {
+         // absent or cancelled
+         continue;
+      }
+
+      size_t start = stringTable + offset;
+      size_t end = data.find('\0', start);
+      if (end == string::npos || end > stringTable + tableSize) {
+         return false;
+      }
+
+      string& value = strings[i];
+      value.reserve(end - start);
+      for (size_t j = start; j < end; j++) {
+         if (data[j] == '$' && j + 1 < end && data[j + 1] == '<') {
+            size_t close = data.find('>', j);
+            if (close != string::npos && close < end) {
+               j = close;
+               continue;
+            }
+         }
+         value.push_back(data[j]);
+      }
+   }
+
+   return true;
+}
+
+/**
+ * @private
+ * @method loadBuiltin
+ * Fills in the capabilities from a built-in table.  Anything that isn't
+ * linux or vt100 is treated as xterm, which is close enough for every
+ * terminal emulator we've run on.
+ * @param {const string&} term - the terminal name.
+ * @returns {bool} always true.
+ */
+bool rterminfo::loadBuiltin(const string& term) {
+   struct entry {
+      size_t index;
+      const char* value;
+   };
+
+   // shared by all three (ANSI cursor movement and editing)
+   static const entry ansi[] = {
+      {TI_CR, "\r"}, {TI_CSR, "\x1B[%i%p1%d;%p2%dr"}, {TI_EL, "\x1B[K"},
+      {TI_ED, "\x1B[J"}, {TI_CUP, "\x1B[%i%p1%d;%p2%dH"}, {TI_CUD1, "\n"},
+      {TI_HOME, "\x1B[H"}, {TI_CUB1, "\b"}, {TI_CUF1, "\x1B[C"},
+      {TI_CUU1, "\x1B[A"}, {TI_BOLD, "\x1B[1m"}, {TI_REV, "\x1B[7m"},
+      {TI_SMUL, "\x1B[4m"}, {TI_CUD, "\x1B[%p1%dB"}, {TI_CUB, "\x1B[%p1%dD"},
+      {TI_CUF, "\x1B[%p1%dC"}, {TI_CUU, "\x1B[%p1%dA"}, {TI_SC, "\x1B" "7"},
+      {TI_RC, "\x1B" "8"}
+   };
+
+   static const entry vt100[] = {
+      {TI_CLEAR, "\x1B[H\x1B[J"}, {TI_SGR0, "\x1B[m\x0F"},
+      {TI_RS2, "\x1B<\x1B>\x1B[?3;4;5l\x1B[?7;8h\x1B[r"},
+      {TI_KCUU1, "\x1BOA"}, {TI_KCUD1, "\x1BOB"}, {TI_KCUF1, "\x1BOC"},
+      {TI_KCUB1, "\x1BOD"}, {TI_KF1, "\x1BOP"}, {TI_KF2, "\x1BOQ"},
+      {TI_KF3, "\x1BOR"}, {TI_KF4, "\x1BOS"}, {TI_KF5, "\x1BOt"},
+      {TI_KF6, "\x1BOu"}, {TI_KF7, "\x1BOv"}, {TI_KF8, "\x1BOl"},
+      {TI_KF9, "\x1BOw"}, {TI_KF10, "\x1BOx"}, {TI_KENT, "\x1BOM"}
+   };
+
+   static const entry linuxConsole[] = {
+      {TI_CLEAR, "\x1B[H\x1B[J"}, {TI_SGR0, "\x1B[m\x0F"},
+      {TI_HPA, "\x1B[%i%p1%dG"}, {TI_VPA, "\x1B[%i%p1%dd"},
+      {TI_CIVIS, "\x1B[?25l\x1B[?1c"}, {TI_CNORM, "\x1B[?25h\x1B[?0c"},
+      {TI_RS1, "\x1B" "c\x1B]R"},
+      {TI_KCUU1, "\x1B[A"}, {TI_KCUD1, "\x1B[B"}, {TI_KCUF1, "\x1B[C"},
+      {TI_KCUB1, "\x1B[D"}, {TI_KF1, "\x1B[[A"}, {TI_KF2, "\x1B[[B"},
+      {TI_KF3, "\x1B[[C"}, {TI_KF4, "\x1B[[D"}, {TI_KF5, "\x1B[[E"},
+      {TI_KF6, "\x1B[17~"}, {TI_KF7, "\x1B[18~"}, {TI_KF8, "\x1B[19~"},
+      {TI_KF9, "\x1B[20~"}, {TI_KF10, "\x1B[21~"}
+   };
+
+   static const entry xterm[] = {
+      {TI_CLEAR, "\x1B[H\x1B[2J"}, {TI_SGR0, "\x1B(B\x1B[m"},
+      {TI_HPA, "\x1B[%i%p1%dG"}, {TI_VPA, "\x1B[%i%p1%dd"},
+      {TI_CIVIS, "\x1B[?25l"}, {TI_CNORM, "\x1B[?12l\x1B[?25h"},
+      {TI_SMCUP, "\x1B[?1049h"}, {TI_RMCUP, "\x1B[?1049l"},
+      {TI_RS1, "\x1B" "c"}, {TI_RS2, "\x1B[!p\x1B[?3;4l\x1B[4l\x1B>"},
+      {TI_KCUU1, "\x1BOA"}, {TI_KCUD1, "\x1BOB"}, {TI_KCUF1, "\x1BOC"},
+      {TI_KCUB1, "\x1BOD"}, {TI_KF1, "\x1BOP"}, {TI_KF2, "\x1BOQ"},
+      {TI_KF3, "\x1BOR"}, {TI_KF4, "\x1BOS"}, {TI_KF5, "\x1B[15~"},
+      {TI_KF6, "\x1B[17~"}, {TI_KF7, "\x1B[18~"}, {TI_KF8, "\x1B[19~"},
+      {TI_KF9, "\x1B[20~"}, {TI_KF10, "\x1B[21~"}, {TI_KENT, "\x1BOM"}
+   };
+
+   strings.assign(TI_KENT + 1, "");
+   numbers.assign(TI_LINES + 1, -1);
+   numbers[TI_COLS] = 80;
+   numbers[TI_LINES] = 24;
+
+   for (auto e : ansi) {
+      strings[e.index] = e.value;
+   }
+
+   if (term.compare(0, 5, "linux") == 0) {
+      for (auto e : linuxConsole) {
+         strings[e.index] = e.value;
+      }
+   } else if (term.compare(0, 5, "vt100") == 0 || term.compare(0, 5, "vt102") == 0) {
+      for (auto e : vt100) {
+         strings[e.index] = e.value;
+      }
+   } else {
+      for (auto e : xterm) {
+         strings[e.index] = e.value;
+      }
+   }
+
+   return true;
+}
+
+/**
+ * @method getString
+ * @param {const size_t} index - one of the TI_ string indices.
+ * @returns {const string&} the capability, or an empty string if absent.
+ */
+const string& rterminfo::getString(const size_t index) const {
+   static const string absent = "";
+   return (index < strings.size()) ? strings[index] : absent;
+}
+
+/**
+ * @method getNumber
+ * @param {const size_t} index - one of the TI_ number indices.
+ * @returns {int} the capability, or -1 if absent.
+ */
+int rterminfo::getNumber(const size_t index) const {
+   return (index < numbers.size()) ? numbers[index] : -1;
+}
+
+/**
+ * @method hasString
+ * @param {const size_t} index - one of the TI_ string indices.
+ * @returns {bool} true if the terminal defines the capability.
+ */
+bool rterminfo::hasString(const size_t index) const {
+   return !getString(index).empty();
+}
+
+#endif
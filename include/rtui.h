@@ -107,14 +107,16 @@ void rtui::scrollDown() {
  * @param {const string [8]} labels - the labels to use
  */
 void rtui::drawFunctionLabels(const string labels[8]) {
+   rt->beginFrame();
    rt->saveCursor();
 
    for (size_t i = 0; i < 8; i++) {
       rt->moveCursor(rt->lines - 1, (rt->cols * i) / 8);
-      cout << labels[i];
+      rt->write(labels[i]);
    }
 
    rt->restoreCursor();
+   rt->endFrame();
 }
 
 /**
@@ -0,0 +1,556 @@
+/*
+ * Helper Functions: rutf8
+ * Project: reneeverly/trs80-pi
+ * License: Apache 2.0
+ * Author: Renee Waverly Sonntag
+ *
+ * Description:
+ *
+ *      UTF-8 validation, code point counting, and display width.
+ *      Replaces temporary_utf8.h, which walked every string a byte at a
+ *      time, returned -1 (as a size_t) on bad input, and counted every
+ *      code point as one column, so CJK and emoji names threw off the
+ *      FileBrowser columns.
+ *
+ *      Filenames are nearly always plain ASCII, so the work is arranged
+ *      around getting through ASCII as fast as possible: the hot loops look
+ *      at 16 bytes at a time with SSE2 (x86) or NEON (ARM, i.e. the Pi),
+ *      or 8 at a time with plain integer tricks anywhere else, and only
+ *      drop to decoding one code point at a time when they hit something
+ *      that isn't ASCII.
+ *
+ *      Widths follow wcwidth(): combining marks and other format characters
+ *      take no columns, East Asian Wide/Fullwidth characters (which
+ *      includes the emoji that default to emoji presentation) take two, and
+ *      everything else takes one.  The tables are from Unicode 14.
+ *      Control characters count as one column since rscreen shows them
+ *      as '?'.  Invalid bytes decode as U+FFFD, one column each.
+ */
+
+#ifndef RUTF8_H
+#define RUTF8_H
+
+#include <algorithm>
+#include <string>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define RUTF8_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RUTF8_NEON
+#endif
+
+using namespace std;
+
+/*
+ * Code point ranges, inclusive, sorted for binary search.
+ */
+struct rutf8Range {
+   char32_t first;
+   char32_t last;
+};
+
+// Mn, Me and Cf, plus the Hangul medial/final jamo and U+200B
+static constexpr rutf8Range rutf8ZeroWidth[] = {
+   {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF},
+   {0x05C1, 0x05C2}, {0x05C4, 0x05C5}, {0x05C7, 0x05C7}, {0x0600, 0x0605},
+   {0x0610, 0x061A}, {0x061C, 0x061C}, {0x064B, 0x065F}, {0x0670, 0x0670},
+   {0x06D6, 0x06DD}, {0x06DF, 0x06E4}, {0x06E7, 0x06E8}, {0x06EA, 0x06ED},
+   {0x070F, 0x070F}, {0x0711, 0x0711}, {0x0730, 0x074A}, {0x07A6, 0x07B0},
+   {0x07EB, 0x07F3}, {0x07FD, 0x07FD}, {0x0816, 0x0819}, {0x081B, 0x0823},
+   {0x0825, 0x0827}, {0x0829, 0x082D}, {0x0859, 0x085B}, {0x0890, 0x089F},
+   {0x08CA, 0x0902}, {0x093A, 0x093A}, {0x093C, 0x093C}, {0x0941, 0x0948},
+   {0x094D, 0x094D}, {0x0951, 0x0957}, {0x0962, 0x0963}, {0x0981, 0x0981},
+   {0x09BC, 0x09BC}, {0x09C1, 0x09C4}, {0x09CD, 0x09CD}, {0x09E2, 0x09E3},
+   {0x09FE, 0x0A02}, {0x0A3C, 0x0A3C}, {0x0A41, 0x0A51}, {0x0A70, 0x0A71},
+   {0x0A75, 0x0A75}, {0x0A81, 0x0A82}, {0x0ABC, 0x0ABC}, {0x0AC1, 0x0AC8},
+   {0x0ACD, 0x0ACD}, {0x0AE2, 0x0AE3}, {0x0AFA, 0x0B01}, {0x0B3C, 0x0B3C},
+   {0x0B3F, 0x0B3F}, {0x0B41, 0x0B44}, {0x0B4D, 0x0B56}, {0x0B62, 0x0B63},
+   {0x0B82, 0x0B82}, {0x0BC0, 0x0BC0}, {0x0BCD, 0x0BCD}, {0x0C00, 0x0C00},
+   {0x0C04, 0x0C04}, {0x0C3C, 0x0C3C}, {0x0C3E, 0x0C40}, {0x0C46, 0x0C56},
+   {0x0C62, 0x0C63}, {0x0C81, 0x0C81}, {0x0CBC, 0x0CBC}, {0x0CBF, 0x0CBF},
+   {0x0CC6, 0x0CC6}, {0x0CCC, 0x0CCD}, {0x0CE2, 0x0CE3}, {0x0D00, 0x0D01},
+   {0x0D3B, 0x0D3C}, {0x0D41, 0x0D44}, {0x0D4D, 0x0D4D}, {0x0D62, 0x0D63},
+   {0x0D81, 0x0D81}, {0x0DCA, 0x0DCA}, {0x0DD2, 0x0DD6}, {0x0E31, 0x0E31},
+   {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E}, {0x0EB1, 0x0EB1}, {0x0EB4, 0x0EBC},
+   {0x0EC8, 0x0ECD}, {0x0F18, 0x0F19}, {0x0F35, 0x0F35}, {0x0F37, 0x0F37},
+   {0x0F39, 0x0F39}, {0x0F71, 0x0F7E}, {0x0F80, 0x0F84}, {0x0F86, 0x0F87},
+   {0x0F8D, 0x0FBC}, {0x0FC6, 0x0FC6}, {0x102D, 0x1030}, {0x1032, 0x1037},
+   {0x1039, 0x103A}, {0x103D, 0x103E}, {0x1058, 0x1059}, {0x105E, 0x1060},
+   {0x1071, 0x1074}, {0x1082, 0x1082}, {0x1085, 0x1086}, {0x108D, 0x108D},
+   {0x109D, 0x109D}, {0x1160, 0x11FF}, {0x135D, 0x135F}, {0x1712, 0x1714},
+   {0x1732, 0x1733}, {0x1752, 0x1753}, {0x1772, 0x1773}, {0x17B4, 0x17B5},
+   {0x17B7, 0x17BD}, {0x17C6, 0x17C6}, {0x17C9, 0x17D3}, {0x17DD, 0x17DD},
+   {0x180B, 0x180F}, {0x1885, 0x1886}, {0x18A9, 0x18A9}, {0x1920, 0x1922},
+   {0x1927, 0x1928}, {0x1932, 0x1932}, {0x1939, 0x193B}, {0x1A17, 0x1A18},
+   {0x1A1B, 0x1A1B}, {0x1A56, 0x1A56}, {0x1A58, 0x1A60}, {0x1A62, 0x1A62},
+   {0x1A65, 0x1A6C}, {0x1A73, 0x1A7F}, {0x1AB0, 0x1B03}, {0x1B34, 0x1B34},
+   {0x1B36, 0x1B3A}, {0x1B3C, 0x1B3C}, {0x1B42, 0x1B42}, {0x1B6B, 0x1B73},
+   {0x1B80, 0x1B81}, {0x1BA2, 0x1BA5}, {0x1BA8, 0x1BA9}, {0x1BAB, 0x1BAD},
+   {0x1BE6, 0x1BE6}, {0x1BE8, 0x1BE9}, {0x1BED, 0x1BED}, {0x1BEF, 0x1BF1},
+   {0x1C2C, 0x1C33}, {0x1C36, 0x1C37}, {0x1CD0, 0x1CD2}, {0x1CD4, 0x1CE0},
+   {0x1CE2, 0x1CE8}, {0x1CED, 0x1CED}, {0x1CF4, 0x1CF4}, {0x1CF8, 0x1CF9},
+   {0x1DC0, 0x1DFF}, {0x200B, 0x200F}, {0x202A, 0x202E}, {0x2060, 0x206F},
+   {0x20D0, 0x20F0}, {0x2CEF, 0x2CF1}, {0x2D7F, 0x2D7F}, {0x2DE0, 0x2DFF},
+   {0x302A, 0x302D}, {0x3099, 0x309A}, {0xA66F, 0xA672}, {0xA674, 0xA67D},
+   {0xA69E, 0xA69F}, {0xA6F0, 0xA6F1}, {0xA802, 0xA802}, {0xA806, 0xA806},
+   {0xA80B, 0xA80B}, {0xA825, 0xA826}, {0xA82C, 0xA82C}, {0xA8C4, 0xA8C5},
+   {0xA8E0, 0xA8F1}, {0xA8FF, 0xA8FF}, {0xA926, 0xA92D}, {0xA947, 0xA951},
+   {0xA980, 0xA982}, {0xA9B3, 0xA9B3}, {0xA9B6, 0xA9B9}, {0xA9BC, 0xA9BD},
+   {0xA9E5, 0xA9E5}, {0xAA29, 0xAA2E}, {0xAA31, 0xAA32}, {0xAA35, 0xAA36},
+   {0xAA43, 0xAA43}, {0xAA4C, 0xAA4C}, {0xAA7C, 0xAA7C}, {0xAAB0, 0xAAB0},
+   {0xAAB2, 0xAAB4}, {0xAAB7, 0xAAB8}, {0xAABE, 0xAABF}, {0xAAC1, 0xAAC1},
+   {0xAAEC, 0xAAED}, {0xAAF6, 0xAAF6}, {0xABE5, 0xABE5}, {0xABE8, 0xABE8},
+   {0xABED, 0xABED}, {0xFB1E, 0xFB1E}, {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F},
+   {0xFEFF, 0xFEFF}, {0xFFF9, 0xFFFB}, {0x101FD, 0x101FD}, {0x102E0, 0x102E0},
+   {0x10376, 0x1037A}, {0x10A01, 0x10A0F}, {0x10A38, 0x10A3F}, {0x10AE5, 0x10AE6},
+   {0x10D24, 0x10D27}, {0x10EAB, 0x10EAC}, {0x10F46, 0x10F50}, {0x10F82, 0x10F85},
+   {0x11001, 0x11001}, {0x11038, 0x11046}, {0x11070, 0x11070}, {0x11073, 0x11074},
+   {0x1107F, 0x11081}, {0x110B3, 0x110B6}, {0x110B9, 0x110BA}, {0x110BD, 0x110BD},
+   {0x110C2, 0x110CD}, {0x11100, 0x11102}, {0x11127, 0x1112B}, {0x1112D, 0x11134},
+   {0x11173, 0x11173}, {0x11180, 0x11181}, {0x111B6, 0x111BE}, {0x111C9, 0x111CC},
+   {0x111CF, 0x111CF}, {0x1122F, 0x11231}, {0x11234, 0x11234}, {0x11236, 0x11237},
+   {0x1123E, 0x1123E}, {0x112DF, 0x112DF}, {0x112E3, 0x112EA}, {0x11300, 0x11301},
+   {0x1133B, 0x1133C}, {0x11340, 0x11340}, {0x11366, 0x11374}, {0x11438, 0x1143F},
+   {0x11442, 0x11444}, {0x11446, 0x11446}, {0x1145E, 0x1145E}, {0x114B3, 0x114B8},
+   {0x114BA, 0x114BA}, {0x114BF, 0x114C0}, {0x114C2, 0x114C3}, {0x115B2, 0x115B5},
+   {0x115BC, 0x115BD}, {0x115BF, 0x115C0}, {0x115DC, 0x115DD}, {0x11633, 0x1163A},
+   {0x1163D, 0x1163D}, {0x1163F, 0x11640}, {0x116AB, 0x116AB}, {0x116AD, 0x116AD},
+   {0x116B0, 0x116B5}, {0x116B7, 0x116B7}, {0x1171D, 0x1171F}, {0x11722, 0x11725},
+   {0x11727, 0x1172B}, {0x1182F, 0x11837}, {0x11839, 0x1183A}, {0x1193B, 0x1193C},
+   {0x1193E, 0x1193E}, {0x11943, 0x11943}, {0x119D4, 0x119DB}, {0x119E0, 0x119E0},
+   {0x11A01, 0x11A0A}, {0x11A33, 0x11A38}, {0x11A3B, 0x11A3E}, {0x11A47, 0x11A47},
+   {0x11A51, 0x11A56}, {0x11A59, 0x11A5B}, {0x11A8A, 0x11A96}, {0x11A98, 0x11A99},
+   {0x11C30, 0x11C3D}, {0x11C3F, 0x11C3F}, {0x11C92, 0x11CA7}, {0x11CAA, 0x11CB0},
+   {0x11CB2, 0x11CB3}, {0x11CB5, 0x11CB6}, {0x11D31, 0x11D45}, {0x11D47, 0x11D47},
+   {0x11D90, 0x11D91}, {0x11D95, 0x11D95}, {0x11D97, 0x11D97}, {0x11EF3, 0x11EF4},
+   {0x13430, 0x13438}, {0x16AF0, 0x16AF4}, {0x16B30, 0x16B36}, {0x16F4F, 0x16F4F},
+   {0x16F8F, 0x16F92}, {0x16FE4, 0x16FE4}, {0x1BC9D, 0x1BC9E}, {0x1BCA0, 0x1BCA3},
+   {0x1CF00, 0x1CF46}, {0x1D167, 0x1D169}, {0x1D173, 0x1D182}, {0x1D185, 0x1D18B},
+   {0x1D1AA, 0x1D1AD}, {0x1D242, 0x1D244}, {0x1DA00, 0x1DA36}, {0x1DA3B, 0x1DA6C},
+   {0x1DA75, 0x1DA75}, {0x1DA84, 0x1DA84}, {0x1DA9B, 0x1DAAF}, {0x1E000, 0x1E02A},
+   {0x1E130, 0x1E136}, {0x1E2AE, 0x1E2AE}, {0x1E2EC, 0x1E2EF}, {0x1E8D0, 0x1E8D6},
+   {0x1E944, 0x1E94A}, {0xE0001, 0xE01EF}
+};
+
+// East Asian Wide and Fullwidth
+static constexpr rutf8Range rutf8Wide[] = {
+   {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC},
+   {0x23F0, 0x23F0}, {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615},
+   {0x2648, 0x2653}, {0x267F, 0x267F}, {0x2693, 0x2693}, {0x26A1, 0x26A1},
+   {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5}, {0x26CE, 0x26CE},
+   {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+   {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B},
+   {0x2728, 0x2728}, {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755},
+   {0x2757, 0x2757}, {0x2795, 0x2797}, {0x27B0, 0x27B0}, {0x27BF, 0x27BF},
+   {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55}, {0x2E80, 0x3029},
+   {0x302E, 0x303E}, {0x3041, 0x3096}, {0x309B, 0x3247}, {0x3250, 0x4DBF},
+   {0x4E00, 0xA4C6}, {0xA960, 0xA97C}, {0xAC00, 0xD7A3}, {0xF900, 0xFAD9},
+   {0xFE10, 0xFE19}, {0xFE30, 0xFE6B}, {0xFF01, 0xFF60}, {0xFFE0, 0xFFE6},
+   {0x16FE0, 0x16FE3}, {0x16FF0, 0x18D08}, {0x1AFF0, 0x1B2FB}, {0x1F004, 0x1F004},
+   {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F200, 0x1F320},
+   {0x1F32D, 0x1F335}, {0x1F337, 0x1F37C}, {0x1F37E, 0x1F393}, {0x1F3A0, 0x1F3CA},
+   {0x1F3CF, 0x1F3D3}, {0x1F3E0, 0x1F3F0}, {0x1F3F4, 0x1F3F4}, {0x1F3F8, 0x1F43E},
+   {0x1F440, 0x1F440}, {0x1F442, 0x1F4FC}, {0x1F4FF, 0x1F53D}, {0x1F54B, 0x1F54E},
+   {0x1F550, 0x1F567}, {0x1F57A, 0x1F57A}, {0x1F595, 0x1F596}, {0x1F5A4, 0x1F5A4},
+   {0x1F5FB, 0x1F64F}, {0x1F680, 0x1F6C5}, {0x1F6CC, 0x1F6CC}, {0x1F6D0, 0x1F6D2},
+   {0x1F6D5, 0x1F6DF}, {0x1F6EB, 0x1F6EC}, {0x1F6F4, 0x1F6FC}, {0x1F7E0, 0x1F7F0},
+   {0x1F90C, 0x1F93A}, {0x1F93C, 0x1F945}, {0x1F947, 0x1F9FF}, {0x1FA70, 0x1FAF6},
+   {0x20000, 0x3FFFD}
+};
+
+#define RUTF8_REPLACEMENT 0xFFFD
+
+/**
+ * @function ascii_prefix_utf8
+ * @param {const char*} str - the bytes to look at.
+ * @param {size_t} length - how many there are.
+ * @returns {size_t} how many bytes at the start are ASCII.
+ */
+size_t ascii_prefix_utf8(const char* str, size_t length) {
+   size_t i = 0;
+
+#if defined(RUTF8_SSE2)
+   for (; i + 16 <= length; i += 16) {
+      __m128i chunk = _mm_loadu_si128((const __m128i*) (str + i));
+      int high = _mm_movemask_epi8(chunk);
+      if (high) {
+         return i + __builtin_ctz(high);
+      }
+   }
+#elif defined(RUTF8_NEON)
+   for (; i + 16 <= length; i += 16) {
+      uint8x16_t chunk = vld1q_u8((const uint8_t*) (str + i));
+      uint64x2_t halves = vreinterpretq_u64_u8(vandq_u8(chunk, vdupq_n_u8(0x80)));
+      if (vgetq_lane_u64(halves, 0) | vgetq_lane_u64(halves, 1)) {
+         break; // the scalar loops below find exactly where
+      }
+   }
+#endif
+
+   // eight at a time
+   for (; i + 8 <= length; i += 8) {
+      uint64_t word;
+      memcpy(&word, str + i, 8);
+      if (word & 0x8080808080808080ULL) {
+         break;
+      }
+   }
+
+   while (i < length && !(str[i] & 0x80)) {
+      i++;
+   }
+   return i;
+}
+
+/**
+ * @function length_utf8
+ * Counts code points by counting every byte that isn't a continuation
+ * byte (10xxxxxx).  Stray continuation bytes in invalid input aren't
+ * counted; nothing is ever reported as an error.
+ * @param {const char*} str - the bytes to count.
+ * @param {size_t} length - how many there are.
+ * @returns {size_t} the number of code points.
+ */
+size_t length_utf8(const char* str, size_t length) {
+   size_t count = 0;
+   size_t i = 0;
+
+#if defined(RUTF8_SSE2)
+   // continuation bytes are the only ones <= (signed) 0xBF
+   const __m128i limit = _mm_set1_epi8((char) 0xBF);
+   while (i + 16 <= length) {
+      // each lane counts up to 255 before the totals are folded in
+      __m128i lanes = _mm_setzero_si128();
+      for (size_t run = 0; run < 255 && i + 16 <= length; run++, i += 16) {
+         __m128i chunk = _mm_loadu_si128((const __m128i*) (str + i));
+         lanes = _mm_sub_epi8(lanes, _mm_cmpgt_epi8(chunk, limit));
+      }
+      __m128i sums = _mm_sad_epu8(lanes, _mm_setzero_si128());
+      count += _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+   }
+#elif defined(RUTF8_NEON)
+   const int8x16_t limit = vdupq_n_s8((int8_t) 0xBF);
+   while (i + 16 <= length) {
+      // each lane counts up to 255 before the totals are folded in
+      uint8x16_t lanes = vdupq_n_u8(0);
+      for (size_t run = 0; run < 255 && i + 16 <= length; run++, i += 16) {
+         int8x16_t chunk = vld1q_s8((const int8_t*) (str + i));
+         lanes = vsubq_u8(lanes, vcgtq_s8(chunk, limit));
+      }
+      uint64x2_t sums = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(lanes)));
+      count += vgetq_lane_u64(sums, 0) + vgetq_lane_u64(sums, 1);
+   }
+#endif
+
+   for (; i + 8 <= length; i += 8) {
+      uint64_t word;
+      memcpy(&word, str + i, 8);
+      uint64_t continuation = word & ~(word << 1) & 0x8080808080808080ULL;
+      count += 8 - __builtin_popcountll(continuation);
+   }
+
+   for (; i < length; i++) {
+      count += ((str[i] & 0xC0) != 0x80);
+   }
+   return count;
+}
+
+/**
+ * @function length_utf8
+ * @see length_utf8
+ */
+size_t length_utf8(const string& str) {
+   return length_utf8(str.data(), str.length());
+}
+
+/**
+ * @function decode_utf8
+ * Decodes one code point, rejecting overlong forms, surrogates, and
+ * anything past U+10FFFF.
+ * @param {const char*} str - the bytes.
+ * @param {size_t} length - how many there are.
+ * @param {size_t&} i - where to start; left at the next code point.
+ * @param {bool*} valid - if given, set to whether the sequence was valid.
+ * @returns {char32_t} the code point, or U+FFFD (consuming one byte).
+ */
+char32_t decode_utf8(const char* str, size_t length, size_t& i, bool* valid = NULL) {
+   const unsigned char* s = (const unsigned char*) str;
+   unsigned char lead = s[i];
+
+   if (lead < 0x80) {
+      i++;
+      if (valid) *valid = true;
+      return lead;
+   }
+
+   size_t extra;
+   char32_t cp;
+   char32_t minimum;
+   if (lead >= 0xC2 && lead <= 0xDF) {
+      extra = 1; cp = lead & 0x1F; minimum = 0x80;
+   } else if ((lead & 0xF0) == 0xE0) {
+      extra = 2; cp = lead & 0x0F; minimum = 0x800;
+   } else if (lead >= 0xF0 && lead <= 0xF4) {
+      extra = 3; cp = lead & 0x07; minimum = 0x10000;
+   } else {
+      extra = 0; cp = 0; minimum = 1;
+   }
+
+   bool ok = (extra > 0 && i + extra < length);
+   for (size_t j = 1; ok && j <= extra; j++) {
+      if ((s[i + j] & 0xC0) != 0x80) {
+         ok = false;
+      } else {
+         cp = (cp << 6) | (s[i + j] & 0x3F);
+      }
+   }
+   ok = ok && cp >= minimum && cp <= 0x10FFFF && (cp < 0xD800 || cp > 0xDFFF);
+
+   if (valid) *valid = ok;
+   if (!ok) {
+      i++;
+      return RUTF8_REPLACEMENT;
+   }
+   i += extra + 1;
+   return cp;
+}
+
+/**
+ * @function valid_utf8
+ * @param {const char*} str - the bytes to check.
+ * @param {size_t} length - how many there are.
+ * @returns {bool} true if they're well-formed UTF-8.
+ */
+bool valid_utf8(const char* str, size_t length) {
+   size_t i = 0;
+   while (true) {
+      i += ascii_prefix_utf8(str + i, length - i);
+      if (i >= length) {
+         return true;
+      }
+      // decode everything up to the next ASCII byte before
+      // going back to the fast loop
+      while (i < length && (str[i] & 0x80)) {
+         bool ok;
+         decode_utf8(str, length, i, &ok);
+         if (!ok) {
+            return false;
+         }
+      }
+   }
+}
+
+/**
+ * @function valid_utf8
+ * @see valid_utf8
+ */
+bool valid_utf8(const string& str) {
+   return valid_utf8(str.data(), str.length());
+}
+
+/**
+ * @private
+ * @function inRanges_utf8
+ * Binary search of a range table.
+ */
+template <size_t N>
+bool inRanges_utf8(const rutf8Range (&table)[N], char32_t cp) {
+   if (cp < table[0].first || cp > table[N - 1].last) {
+      return false;
+   }
+   size_t low = 0;
+   size_t high = N;
+   while (low < high) {
+      size_t middle = (low + high) / 2;
+      if (cp > table[middle].last) {
+         low = middle + 1;
+      } else if (cp < table[middle].first) {
+         high = middle;
+      } else {
+         return true;
+      }
+   }
+   return false;
+}
+
+/**
+ * @function width_utf8
+ * @param {char32_t} cp - a code point.
+ * @returns {size_t} the columns it takes up: 0, 1, or 2.
+ */
+size_t width_utf8(char32_t cp) {
+   if (cp < 0x300) {
+      return 1;
+   }
+   // the bulk of CJK text, without a search
+   if ((cp >= 0x4E00 && cp <= 0x9FFF) || (cp >= 0x3041 && cp <= 0x3096) || (cp >= 0xAC00 && cp <= 0xD7A3)) {
+      return 2;
+   }
+   if (inRanges_utf8(rutf8ZeroWidth, cp)) {
+      return 0;
+   }
+   if (inRanges_utf8(rutf8Wide, cp)) {
+      return 2;
+   }
+   return 1;
+}
+
+/**
+ * @function width_utf8
+ * @param {const char*} str - the bytes.
+ * @param {size_t} length - how many there are.
+ * @returns {size_t} the columns the text takes up.
+ */
+size_t width_utf8(const char* str, size_t length) {
+   size_t width = 0;
+   size_t i = 0;
+   while (true) {
+      // every ASCII byte is one column
+      size_t ascii = ascii_prefix_utf8(str + i, length - i);
+      width += ascii;
+      i += ascii;
+      if (i >= length) {
+         return width;
+      }
+      while (i < length && (str[i] & 0x80)) {
+         width += width_utf8(decode_utf8(str, length, i));
+      }
+   }
+}
+
+/**
+ * @function width_utf8
+ * @see width_utf8
+ */
+size_t width_utf8(const string& str) {
+   return width_utf8(str.data(), str.length());
+}
+
+/**
+ * @function truncate_utf8
+ * The longest start of the text that fits in the given columns.  A wide
+ * character that would straddle the limit is left out whole, and
+ * combining marks stay with the character they follow.
+ * @param {const string&} str - the text.
+ * @param {size_t} columns - how many columns there are.
+ * @returns {string} the part that fits.
+ */
+string truncate_utf8(const string& str, size_t columns) {
+   const char* s = str.data();
+   size_t length = str.length();
+
+   // plain ASCII is one byte per column
+   size_t ascii = ascii_prefix_utf8(s, min(length, columns + 1));
+   if (ascii == length || ascii > columns) {
+      return str.substr(0, columns);
+   }
+
+   size_t width = ascii;
+   size_t i = ascii;
+   while (i < length) {
+      size_t next = i;
+      size_t w = width_utf8(decode_utf8(s, length, next));
+      if (width + w > columns) {
+         break;
+      }
+      width += w;
+      i = next;
+   }
+   return str.substr(0, i);
+}
+
+/**
+ * @function truncate_front_utf8
+ * The longest end of the text that fits in the given columns, never
+ * starting on a combining mark.
+ * @param {const string&} str - the text.
+ * @param {size_t} columns - how many columns there are.
+ * @returns {string} the part that fits.
+ */
+string truncate_front_utf8(const string& str, size_t columns) {
+   const char* s = str.data();
+   size_t length = str.length();
+
+   if (ascii_prefix_utf8(s, length) == length) {
+      return (length > columns) ? str.substr(length - columns) : str;
+   }
+
+   // drop characters from the front until the rest fits
+   size_t remaining = width_utf8(s, length);
+   size_t i = 0;
+   while (i < length) {
+      size_t next = i;
+      size_t w = width_utf8(decode_utf8(s, length, next));
+      if (remaining <= columns && w > 0) {
+         break;
+      }
+      remaining -= w;
+      i = next;
+   }
+   return str.substr(i);
+}
+
+/**
+ * @function pop_back_utf8
+ * Removes the last code point.
+ * https://stackoverflow.com/questions/37623359/how-to-remove-the-last-character-of-a-utf-8-string-in-c
+ */
+void pop_back_utf8(string& utf8) {
+   if(utf8.empty())
+      return;
+
+   auto cp = utf8.data() + utf8.size();
+   while(--cp >= utf8.data() && ((*cp & 0b10000000) && !(*cp & 0b01000000))) {}
+   if(cp >= utf8.data())
+      utf8.resize(cp - utf8.data());
+}
+
+/**
+ * @function substr_utf8
+ * Like string::substr, but counting code points.
+ * @param {const string&} str - the text.
+ * @param {size_t} start - the first code point to keep.
+ * @param {size_t} leng - how many to keep, or string::npos for the rest.
+ * @returns {string} the code points asked for.
+ */
+string substr_utf8(const string& str, size_t start, size_t leng) {
+   const char* s = str.data();
+   size_t length = str.length();
+
+   // find the byte where code point number `count` begins
+   auto advance = [&](size_t from, size_t count) {
+      size_t ascii = ascii_prefix_utf8(s + from, min(length - from, count));
+      from += ascii;
+      count -= ascii;
+      while (from < length) {
+         if ((s[from] & 0xC0) != 0x80) {
+            if (count == 0) {
+               break;
+            }
+            count--;
+         }
+         from++;
+      }
+      return from;
+   };
+
+   size_t begin = advance(0, start);
+   if (leng == string::npos) {
+      return str.substr(begin);
+   }
+   return str.substr(begin, advance(begin, leng) - begin);
+}
+
+/**
+ * @function substr_utf8
+ * For when only a start index is provided
+ */
+string substr_utf8(const string& str, size_t start) {
+   return substr_utf8(str, start, string::npos);
+}
+
+#endif
@@ -1,5 +1,5 @@
 /*
- * Class: rtui
+ * Class: FileBrowser
  * Program: menu
  * Project: reneeverly/trs80-pi
  * License: Apache 2.0
@@ -7,7 +7,7 @@
  * 
  * Description:
  *
- *      Provides a file browser which takes advantage of rterm and handles
+ *      Provides a file browser which takes advantage of rscreen and handles
  *      all drawing functionality related to selecting a file.
  */
 
@@ -18,23 +18,73 @@
 #include <vector>
 
 // terminal manipulation
-#include "../../include/rterm.h"
+#include "../../include/rscreen.h"
 
-// Temporary UTF8 support
-#include "../../include/temporary_utf8.h"
+// UTF8 support
+#include "../../include/rutf8.h"
+
+// the list of names
+#include "../../include/ritems.h"
+
+// fuzzy filtering
+#include "../../include/rfuzzy.h"
 
 class FileBrowser {
    private:
-      rterm* rt;
+      rscreen* screen;
 
-      const vector<string>* items;
+      const ritems* items;
       size_t selectedIndex;
 
+      // if not NULL, only these items are shown, in this order, and the
+      // characters the matcher matched in each are underlined
+      const vector<uint32_t>* view;
+      rfuzzy* matcher;
+      vector<size_t> matched;
+
+      // the widest item's display width, found only when the items change
+      size_t itemCount;
+      size_t widestItem;
+      bool itemsChanged;
+
+      // layout, recomputed only when the items or the screen size change
+      size_t layoutLines;
+      size_t layoutCols;
+      size_t preferredNameLength;
       size_t itemsPerLine;
+      size_t itemsPerPage;
+
+      // labels (with the leading space, ellipsized to fit) for one page
+      // only, built the first time each item on it is drawn
+      size_t labelPage;
+      vector<string> labels;
+      vector<bool> labelReady;
+
+      // what's in the screen's back buffer: the page, and the
+      // screen generation it was drawn under
+      size_t drawnPage;
+      unsigned long drawnGeneration;
+
+      size_t visibleCount() const;
+      size_t itemAt(const size_t) const;
+      void updateWidths();
+      void updateLayout();
+      const string& label(const size_t);
+      void highlightCell(const size_t, const size_t, const size_t, const unsigned char);
+      void drawCell(const size_t);
+      void moveSelection(const size_t);
+      void redrawFrom(const size_t);
       
    public:
-      FileBrowser(rterm*, const vector<string>*);
+      FileBrowser(rscreen*, const ritems*);
+
+      static size_t itemWidth(const ritems&, const size_t);
 
+      void setItems(const ritems*, const size_t = string::npos);
+      bool addedItems(const size_t, const size_t = 0, const size_t = string::npos);
+      void insertedItem(const size_t, const size_t);
+      void removedItem(const size_t);
+      void setView(const vector<uint32_t>*, rfuzzy* = NULL);
       void redrawTable();
 
       void pressedLeft();
@@ -42,93 +92,462 @@ class FileBrowser {
       void pressedUp();
       void pressedDown();
       void setIndex(const size_t);
+      void selectItem(const size_t);
 
       size_t getIndex();
+      size_t getItem();
 };
 
 /**
  * @constructs FileBrowser
- * @param {rterm*} newrt - the rterm object to reference for terminal manip.
+ * @param {rscreen*} newscreen - the screen to draw the table into.
+ * @param {const ritems*} newitems - the names to list.
  */
-FileBrowser::FileBrowser(rterm* newrt, const vector<string>* newitems) {
-   rt = newrt;
+FileBrowser::FileBrowser(rscreen* newscreen, const ritems* newitems) {
+   screen = newscreen;
    items = newitems;
    selectedIndex = 0;
-
-   // set scroll region to just the table
-   rt->changeScrollRegion(1, rt->lines - 2);
+   view = NULL;
+   matcher = NULL;
+   itemsChanged = true;
+   itemCount = 0;
+   layoutLines = 0;
+   layoutCols = 0;
+   labelPage = string::npos;
+   drawnPage = string::npos;
 
    redrawTable();
 }
 
 /**
- * @method redrawTable
- * Does all of the calculations required for laying out the files in a table
- * and then draw them to the screen.
+ * @method itemWidth
+ * @param {const ritems&} list - a list of names.
+ * @param {const size_t} index - which one.
+ * @returns {size_t} the columns it takes in the table, not counting the
+ * space before it (directories get a '/' after them).
  */
-void FileBrowser::redrawTable() {
-   size_t preferredNameLength;
+size_t FileBrowser::itemWidth(const ritems& list, const size_t index) {
+   string_view name = list[index];
+   return width_utf8(name.data(), name.length()) + ((list.flags(index) & RI_DIRECTORY) ? 1 : 0);
+}
 
-   // Get the longest filename in the vector
-   size_t longestNameLength = 0;
-   for (auto iter : *items) {
-      if (length_utf8(iter) > longestNameLength) {
-         longestNameLength = length_utf8(iter);
+/**
+ * @method setItems
+ * Call whenever the list changes (or to switch to another list) so the
+ * cached widths and labels are rebuilt.  Doesn't redraw.
+ * @param {const ritems*} newitems - the names to list.
+ * @param {const size_t} widest - the widest itemWidth() in the list, if
+ * already known (e.g. kept with a cached listing), to skip measuring.
+ */
+void FileBrowser::setItems(const ritems* newitems, const size_t widest) {
+   items = newitems;
+   view = NULL;
+   matcher = NULL;
+   itemsChanged = true;
+   if (widest != string::npos) {
+      itemsChanged = false;
+      itemCount = items->size();
+      widestItem = widest;
+      layoutLines = 0;
+      layoutCols = 0;
+   }
+   labelPage = string::npos;
+   drawnPage = string::npos;
+   if (selectedIndex >= items->size()) {
+      selectedIndex = 0;
+   }
+}
+
+/**
+ * @method addedItems
+ * Call after items were added to (or merged into) the list, e.g. as a
+ * directory scan streams in, with the widest of the new items' display
+ * widths.  Cheaper than setItems(): the old items aren't measured again,
+ * and the layout only changes if the columns have to get wider.  Doesn't
+ * redraw.
+ * @param {const size_t} widest - the widest new item's display width.
+ * @param {const size_t} first - the first index whose item changed;
+ * everything before it is where it was.
+ * @param {const size_t} selected - where the selected item went, if
+ * new items landed ahead of it (with no view set).
+ * @returns {bool} true if the page on screen is out of date (there's no
+ * need to redraw otherwise).
+ */
+bool FileBrowser::addedItems(const size_t widest, const size_t first, const size_t selected) {
+   if (!itemsChanged) {
+      itemCount = items->size();
+      if (widest > widestItem) {
+         widestItem = widest;
+         layoutLines = 0;
+         layoutCols = 0;
       }
    }
-   longestNameLength++; // allow for spacing
 
-   if (longestNameLength > (rt->cols / 4)) {
+   if (!view && selected != string::npos) {
+      selectedIndex = selected;
+   }
+   if (selectedIndex >= visibleCount()) {
+      selectedIndex = 0;
+   }
+
+   // a page that ends before the first change still shows the same items
+   bool laidOut = layoutLines == screen->lines && layoutCols == screen->cols && !itemsChanged && !view;
+   if (!laidOut || (labelPage != string::npos && first < (labelPage + 1) * itemsPerPage)) {
+      labelPage = string::npos;
+   }
+   if (laidOut && drawnPage != string::npos && drawnPage == selectedIndex / itemsPerPage
+         && drawnGeneration == screen->generation && first >= (drawnPage + 1) * itemsPerPage) {
+      return false;
+   }
+   drawnPage = string::npos;
+   return true;
+}
+
+/**
+ * @method insertedItem
+ * Call after a single item was inserted into the list (with no view
+ * set).  The selection stays on the same item, and only the cells from
+ * the new one to the end of the page are drawn again.
+ * @param {const size_t} index - where it went in.
+ * @param {const size_t} width - its itemWidth().
+ */
+void FileBrowser::insertedItem(const size_t index, const size_t width) {
+   if (!itemsChanged) {
+      itemCount = items->size();
+      if (width > widestItem) {
+         widestItem = width;
+         layoutLines = 0;
+         layoutCols = 0;
+      }
+   }
+   if (items->size() > 1 && index <= selectedIndex) {
+      selectedIndex++;
+   }
+   redrawFrom(index);
+}
+
+/**
+ * @method removedItem
+ * Call after a single item was removed from the list (with no view set).
+ * The selection stays on the same item (or the one after, if it was the
+ * one removed), and only the cells from the gap to the end of the page
+ * are drawn again.  The columns don't get narrower until the list is
+ * measured again.
+ * @param {const size_t} index - where it was.
+ */
+void FileBrowser::removedItem(const size_t index) {
+   if (!itemsChanged) {
+      itemCount = items->size();
+   }
+   if (selectedIndex > 0 && (index < selectedIndex || selectedIndex >= items->size())) {
+      selectedIndex--;
+   }
+   redrawFrom(index);
+}
+
+/**
+ * @method setView
+ * Shows only some of the items, in the given order (e.g. what a filter
+ * matched, best first), or all of them again.  The columns stay as wide
+ * as the whole list needs, so the table doesn't jump around while
+ * typing.  Selects the first item shown.  Doesn't redraw.
+ * @param {const vector<uint32_t>*} newview - the items to show, or NULL
+ * for all of them.  Must stay valid until the next setView().
+ * @param {rfuzzy*} newmatcher - if not NULL, underlines the characters it
+ * matched in each item.
+ */
+void FileBrowser::setView(const vector<uint32_t>* newview, rfuzzy* newmatcher) {
+   view = newview;
+   matcher = newmatcher;
+   selectedIndex = 0;
+   labelPage = string::npos;
+   drawnPage = string::npos;
+}
+
+/**
+ * @private
+ * @method visibleCount
+ * @returns {size_t} how many items are shown.
+ */
+size_t FileBrowser::visibleCount() const {
+   return view ? view->size() : items->size();
+}
+
+/**
+ * @private
+ * @method itemAt
+ * @param {const size_t} position - a place in the table.
+ * @returns {size_t} the item shown there.
+ */
+size_t FileBrowser::itemAt(const size_t position) const {
+   return view ? (*view)[position] : position;
+}
+
+/**
+ * @private
+ * @method updateWidths
+ * Measures every item once to find the widest.  Nothing per item is
+ * kept, so the browser's memory doesn't grow with the list.
+ */
+void FileBrowser::updateWidths() {
+   // a list that grew or shrank without setItems() still counts
+   if (!itemsChanged && itemCount == items->size()) {
+      return;
+   }
+   itemsChanged = false;
+   itemCount = items->size();
+
+   widestItem = 0;
+   for (size_t i = 0; i < itemCount; i++) {
+      size_t width = itemWidth(*items, i);
+      if (width > widestItem) {
+         widestItem = width;
+      }
+   }
+
+   // the column width may change, so everything has to be laid out again
+   layoutLines = 0;
+   layoutCols = 0;
+}
+
+/**
+ * @private
+ * @method updateLayout
+ * Works out the column width and how many items fit on a line and a page.
+ * Only runs when the items or the screen size differ from the ones the
+ * current layout was made for.
+ */
+void FileBrowser::updateLayout() {
+   updateWidths();
+   if (layoutLines == screen->lines && layoutCols == screen->cols) {
+      return;
+   }
+   layoutLines = screen->lines;
+   layoutCols = screen->cols;
+
+   size_t longestNameLength = widestItem + 1; // allow for spacing
+
+   if (longestNameLength > (screen->cols / 4)) {
       // cap the length if it's longer than one fourth of the screen width
-      preferredNameLength = (rt->cols / 4);
+      preferredNameLength = (screen->cols / 4);
    } else {
       // let's loop until we get an ideal number of columns
       for (size_t i = 5; i < 16; i++) {
-         preferredNameLength = rt->cols / (i-1);
-         if (longestNameLength > (rt->cols / i)) {
+         preferredNameLength = screen->cols / (i-1);
+         if (longestNameLength > (screen->cols / i)) {
             break;
          }
       }
    }
 
+   // guard against terminals too small to hold anything
+   if (preferredNameLength == 0) {
+      preferredNameLength = 1;
+   }
+
    // adjust the object-wide variable because it's used by pressedDown/Up
-   itemsPerLine = rt->cols / preferredNameLength;
+   itemsPerLine = screen->cols / preferredNameLength;
+   if (itemsPerLine == 0) {
+      itemsPerLine = 1;
+   }
 
-   size_t itemsPerPage = itemsPerLine * (rt->lines - 2);
+   itemsPerPage = itemsPerLine * ((screen->lines > 2) ? (screen->lines - 2) : 1);
 
-   // determine which page we need to render
-   size_t pageNumber = selectedIndex / itemsPerPage;
+   // labels depend on the column width
+   labelPage = string::npos;
 
-   // Save cursor location
-   rt->saveCursor();
+   // and so does every cell's position
+   drawnPage = string::npos;
+}
 
-   // render items
-   rt->moveCursor(1,0);
-   size_t itemsInThisLine = 0;
-   for (size_t i = (pageNumber * itemsPerPage); i < ((pageNumber + 1) * itemsPerPage); i++) {
-      // get item name or fill with " -.-" if out of range
-      string thisFileName = ((i < items->size()) ? " " + items->at(i) : " -.-");
+/**
+ * @private
+ * @method label
+ * @param {const size_t} index - which item.
+ * @returns {const string&} the item as it's shown in its column.
+ */
+const string& FileBrowser::label(const size_t index) {
+   // only the page being drawn has labels
+   size_t pageNumber = index / itemsPerPage;
+   if (pageNumber != labelPage) {
+      labelPage = pageNumber;
+      labels.resize(itemsPerPage);
+      labelReady.assign(itemsPerPage, false);
+   }
 
-      // check if length is longer than available per column
-      if (length_utf8(thisFileName) > preferredNameLength) {
-         thisFileName = (substr_utf8(thisFileName, 0, (preferredNameLength / 2) - 1) + "…" + substr_utf8(thisFileName, length_utf8(thisFileName) - (preferredNameLength / 2)));
+   size_t slot = index % itemsPerPage;
+   if (!labelReady[slot]) {
+      string& thisFileName = labels[slot];
+      string_view name = (*items)[itemAt(index)];
+      thisFileName.assign(" ");
+      thisFileName.append(name.data(), name.length());
+      if (items->flags(itemAt(index)) & RI_DIRECTORY) {
+         thisFileName.push_back('/');
       }
 
-      cout << ((i == selectedIndex) ? rt->getReverse() : "")
-           << setw(preferredNameLength) << left
-           << thisFileName
-           << ((i == selectedIndex) ? rt->getResetAttributes() : "");
+      // check if it's wider than available per column, and if so
+      // keep the start and end with an ellipsis in the middle
+      if (width_utf8(thisFileName) > preferredNameLength) {
+         size_t half = preferredNameLength / 2;
+         thisFileName = truncate_utf8(thisFileName, (half > 0) ? half - 1 : 0) + "…" + truncate_front_utf8(thisFileName, half);
+      }
+      labelReady[slot] = true;
+   }
+   return labels[slot];
+}
 
-      itemsInThisLine++;
+/**
+ * @private
+ * @method highlightCell
+ * Underlines the characters the matcher matched in an item that's just
+ * been drawn, wherever they ended up in its (maybe ellipsized) label.
+ * @param {const size_t} i - the position of the item.
+ * @param {const size_t} line - the line the cell is on.
+ * @param {const size_t} col - the column the cell starts at.
+ * @param {const unsigned char} attr - the cell's attributes.
+ */
+void FileBrowser::highlightCell(const size_t i, const size_t line, const size_t col, const unsigned char attr) {
+   if (!matcher->positions(itemAt(i), matched) || matched.empty()) {
+      return;
+   }
+   string_view name = (*items)[itemAt(i)];
+
+   // columns in " name" shown before and after the ellipsis, if any
+   size_t fullWidth = 1 + itemWidth(*items, itemAt(i));
+   size_t headWidth = fullWidth;
+   size_t tailWidth = 0;
+   if (fullWidth > preferredNameLength) {
+      const string& shown = label(i);
+      string full = " " + string(name);
+      size_t half = preferredNameLength / 2;
+      headWidth = width_utf8(truncate_utf8(full, (half > 0) ? half - 1 : 0));
+      tailWidth = width_utf8(shown) - headWidth - 1;
+   }
 
-      if ((itemsInThisLine >= itemsPerLine) && ((i % itemsPerPage) != (itemsPerPage - 1))) {
-         itemsInThisLine = 0;
-         cout << endl;
+   // walk the name a character at a time, keeping track of its column
+   size_t at = 1;
+   size_t next = 0;
+   size_t offset = 0;
+   while (offset < name.length() && next < matched.size()) {
+      size_t start = offset;
+      size_t width = width_utf8(decode_utf8(name.data(), name.length(), offset));
+      if (start == matched[next]) {
+         next++;
+         if (at + width <= headWidth) {
+            screen->attribute(line, col + at, width, attr | RS_UNDERLINE);
+         } else if (tailWidth > 0 && at >= fullWidth - tailWidth) {
+            screen->attribute(line, col + headWidth + 1 + (at - (fullWidth - tailWidth)), width, attr | RS_UNDERLINE);
+         }
       }
+      at += width;
+   }
+}
+
+/**
+ * @private
+ * @method drawCell
+ * Draws one item (or a " -.-" filler) into its place on the page,
+ * highlighted if it's the selection.
+ * @param {const size_t} i - the index of the item.
+ */
+void FileBrowser::drawCell(const size_t i) {
+   // get item label or fill with " -.-" if out of range
+   static const string empty = " -.-";
+   const string& thisFileName = ((i < visibleCount()) ? label(i) : empty);
+
+   size_t cellInPage = i % itemsPerPage;
+   size_t line = 1 + (cellInPage / itemsPerLine);
+   size_t col = (cellInPage % itemsPerLine) * preferredNameLength;
+   unsigned char attr = ((i == selectedIndex) ? RS_REVERSE : RS_NORMAL);
+
+   size_t end = screen->put(line, col, thisFileName, attr);
+   screen->fill(line, end, col + preferredNameLength - end, attr);
+
+   if (matcher && i < visibleCount()) {
+      highlightCell(i, line, col, attr);
+   }
+}
+
+/**
+ * @method redrawTable
+ * Does all of the calculations required for laying out the files in a table
+ * and then draw them to the screen.  Only the cells that actually changed
+ * are sent to the terminal (see rscreen::present).
+ */
+void FileBrowser::redrawTable() {
+   updateLayout();
+
+   // determine which page we need to render
+   size_t pageNumber = selectedIndex / itemsPerPage;
+
+   // render items, one row per screen line starting below the clock
+   for (size_t i = (pageNumber * itemsPerPage); i < ((pageNumber + 1) * itemsPerPage); i++) {
+      drawCell(i);
+   }
+
+   // blank whatever is right of the last column, in case the columns
+   // were wider before
+   size_t tableWidth = itemsPerLine * preferredNameLength;
+   for (size_t line = 1; line + 1 < screen->lines; line++) {
+      screen->fill(line, tableWidth, screen->cols - min(tableWidth, screen->cols));
+   }
+   drawnPage = pageNumber;
+   drawnGeneration = screen->generation;
+
+   screen->present();
+}
+
+/**
+ * @private
+ * @method moveSelection
+ * Moves the highlight from the previous selection to the current one.
+ * If both are on the page that's already drawn, only those two cells are
+ * drawn again; otherwise the whole page is.
+ * @param {const size_t} previous - the index that was selected.
+ */
+void FileBrowser::moveSelection(const size_t previous) {
+   updateLayout();
+
+   size_t pageNumber = selectedIndex / itemsPerPage;
+   if (pageNumber != drawnPage || previous / itemsPerPage != drawnPage
+         || drawnGeneration != screen->generation) {
+      redrawTable();
+      return;
+   }
+
+   drawCell(previous);
+   drawCell(selectedIndex);
+   screen->present();
+}
+
+/**
+ * @private
+ * @method redrawFrom
+ * Draws the cells from an index to the end of the selection's page, if
+ * that page is the one already drawn; otherwise the whole page.
+ * @param {const size_t} index - the first item that changed.
+ */
+void FileBrowser::redrawFrom(const size_t index) {
+   updateLayout();
+   // the labels from index on have shifted
+   labelPage = string::npos;
+
+   size_t pageNumber = selectedIndex / itemsPerPage;
+   if (pageNumber != drawnPage || drawnGeneration != screen->generation) {
+      redrawTable();
+      return;
    }
 
-   // restore cursor location
-   rt->restoreCursor();
+   size_t first = pageNumber * itemsPerPage;
+   size_t last = first + itemsPerPage;
+   if (index >= last) {
+      // nothing on this page moved
+      return;
+   }
+   for (size_t i = max(index, first); i < last; i++) {
+      drawCell(i);
+   }
+   screen->present();
 }
 
 /**
@@ -136,17 +555,18 @@ void FileBrowser::redrawTable() {
  * Decrements the selectedIndex with wrapping to the end.
  */
 void FileBrowser::pressedLeft() {
+   size_t previous = selectedIndex;
    selectedIndex--;
 
    // Account for out of bounds (wrap to end)
    // IMPORTANT: size_t cannot be less than 0
    // so we have to use the same check as in pressedRight
    // but we'll set it to the last item rather than the first
-   if (selectedIndex >= items->size()) {
-      selectedIndex = items->size() - 1;
+   if (selectedIndex >= visibleCount()) {
+      selectedIndex = (visibleCount() > 0) ? visibleCount() - 1 : 0;
    }
 
-   redrawTable();
+   moveSelection(previous);
 }
 
 /**
@@ -154,14 +574,15 @@ void FileBrowser::pressedLeft() {
  * Increments the selectedIndex with wrapping to the start
  */
 void FileBrowser::pressedRight() {
+   size_t previous = selectedIndex;
    selectedIndex++;
    
    // Account for out of bounds (wrap to start)
-   if (selectedIndex >= items->size()) {
+   if (selectedIndex >= visibleCount()) {
       selectedIndex = 0;
    }
 
-   redrawTable();
+   moveSelection(previous);
 }
 
 /**
@@ -172,16 +593,17 @@ void FileBrowser::pressedRight() {
  * location.
  */
 void FileBrowser::pressedUp() {
+   size_t previous = selectedIndex;
    selectedIndex -= itemsPerLine;
 
    // Account for out of bounds (undo the subtraction)
    // same caveat as wih pressedLeft, size_t has no less than 0,
    // so we're just using the same comparison as in pressedDown
-   if (selectedIndex >= items->size()) {
+   if (selectedIndex >= visibleCount()) {
       selectedIndex += itemsPerLine;
    }
 
-   redrawTable();
+   moveSelection(previous);
 }
 
 /**
@@ -192,14 +614,15 @@ void FileBrowser::pressedUp() {
  * location.
  */
 void FileBrowser::pressedDown() {
+   size_t previous = selectedIndex;
    selectedIndex += itemsPerLine;
 
    // Account for out of bounds (undo the addition)
-   if (selectedIndex >= items->size()) {
+   if (selectedIndex >= visibleCount()) {
       selectedIndex -= itemsPerLine;
    }
 
-   redrawTable();
+   moveSelection(previous);
 }
 
 /**
@@ -208,8 +631,27 @@ void FileBrowser::pressedDown() {
  * @param {const size_t} newIndex - the new index to select
  */
 void FileBrowser::setIndex(const size_t newIndex) {
+   size_t previous = selectedIndex;
    selectedIndex = newIndex;
-   redrawTable();
+   moveSelection(previous);
+}
+
+/**
+ * @method selectItem
+ * Selects whichever cell shows an item, if any does.
+ * @param {const size_t} item - the item's index in the list.
+ */
+void FileBrowser::selectItem(const size_t item) {
+   size_t position = string::npos;
+   if (!view) {
+      position = (item < items->size()) ? item : string::npos;
+   } else {
+      auto found = find(view->begin(), view->end(), item);
+      if (found != view->end()) {
+         position = found - view->begin();
+      }
+   }
+   setIndex((position != string::npos) ? position : 0);
 }
 
 /**
@@ -221,4 +663,13 @@ size_t FileBrowser::getIndex() {
    return selectedIndex;
 }
 
+/**
+ * @method getItem
+ * Returns the item that's selected
+ * @returns {size_t} its index in the list, or string::npos if nothing is shown
+ */
+size_t FileBrowser::getItem() {
+   return (selectedIndex < visibleCount()) ? itemAt(selectedIndex) : string::npos;
+}
+
 #endif
@@ -14,11 +14,16 @@
  *      in rterm.h.
  *
  *      TODO:
- *      [ ] Figure out how to handle folders / navigate them
- *      [ ] fork/exec programs selected
- *          [x] fork
- *              [ ] Handle fork failure
- *          [x] exec
+ *      [x] Figure out how to handle folders / navigate them
+ *          [x] Enter opens a directory, backspace on an empty buffer
+ *              goes up
+ *          [x] Remember recent directories and their selection
+ *          [x] Follow files being created and deleted (inotify)
+ *          [x] Start from the listing saved last time, and check it
+ *              in the background
+ *      [ ] run programs selected
+ *          [x] posix_spawn (no fork)
+ *              [x] Handle spawn failure
  *              [x] Handle exec failure
  *          [x] wait
  *      [ ] config file? for default programs given extension/format
@@ -29,6 +34,7 @@
  *          [x] Tab completion for existing files or programs
  *          [ ] Create new text file when path not exist
  *          [x] Key combo to clear buffer
+ *          [x] Ctrl-F: narrow the table down as you type (fuzzy)
  *              [x] When invalid name and [enter] pressed, clear
  *                  This is the original m100 behavior, but might not
  *                  be ideal for a modern implementation.
@@ -36,12 +42,17 @@
 
 #include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
 #include <stdio.h>
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <poll.h>
+#include <limits.h>
 #include <signal.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -51,241 +62,848 @@
 // Filesystem
 #include <filesystem>
 
-// Threads
-#include <pthread.h>
+// Event loop
+#include "../../include/rloop.h"
+#include "../../include/rspawn.h"
 
 // Terminal manipulation
 #include "../../include/rterm.h"
+#include "../../include/rscreen.h"
 
 // Keyboard
 #include "../../include/rkeyboard.h"
 
 // FileBrowser
+#include "../../include/ritems.h"
+#include "../../include/rscan.h"
+#include "../../include/rprefix.h"
+#include "../../include/rfuzzy.h"
+#include "../../include/rdircache.h"
+#include "../../include/rdirwatch.h"
+#include "../../include/rlistcache.h"
 #include "FileBrowser.h"
 
-// Temporary UTF8 support
-#include "../../include/temporary_utf8.h"
+// UTF8 support
+#include "../../include/rutf8.h"
 
 using namespace std;
 
 // some constants
 #define ESCAPEKEY 27
-
-typedef struct _thread_data_t {
-   int tid;
-} thread_data_t;
+#define FILTERKEY 0x06 // ctrl-f
 
 rterm rt;
+rscreen screen(&rt);
+rkeyboard keyboard;
 FileBrowser* fb;
 
-bool clock_loop;
-pthread_mutex_t lock_x;
+// everything menu waits on goes through this one loop
+rloop loop;
+int keyboardWatch = -1;
+
+// the clock ticks every second, or every minute (without seconds) with
+// TRS80_CLOCK=minutes; it only looks the time up once a minute
+long clockPeriod = 1;
+int clockWatch = -1;
+time_t clockMinute = -1;
+size_t clockColumn = 0;
+unsigned long clockGeneration = 0;
+
+// the "Bytes free" field shows a sample taken every diskPeriod seconds
+// (TRS80_DISK_INTERVAL, 0 for never) and whenever a child exits, of the
+// root filesystem or with TRS80_DISK=cwd of the current directory's
+long diskPeriod = 10;
+bool diskFollowsCwd = false;
+int diskWatch = -1;
+unsigned long long diskFree = 0;
+
+// state shared between the loop's callbacks
+ritems files;
+rprefix filesByName(&files);
+rfuzzy filesFuzzy(&files);
+size_t filesWidest = 0;
+rscan scanner;
+int scanWatch = -1;
+
+// the directory being shown (as stat()ed before reading it), the last
+// few shown before it, and a name to select once the scan finds it
+struct stat here;
+rdircache visited;
+string reselect;
+
+// names inotify says changed, waiting for a scan or a child to finish
+rdirwatch watcher;
+vector<string> pendingChanges;
+bool rescanNeeded = false;
+
+// listings saved between runs; while one is being checked against the
+// directory, the scan goes into scanned instead of files
+rlistcache snapshots;
+bool revalidating = false;
+bool snapshotStale = false;
+ritems scanned;
+
+// otherwise scanned holds what's been read but not yet merged into files:
+// small lists take every batch straight away, bigger ones wait until a
+// quarter as much again has come in, so a huge directory is merged a
+// couple of dozen times rather than once per batch
+const size_t mergeEveryBatch = 4096;
+string searchKey = "";
+size_t messageWidth = 0;
+bool filterMode = false;
+bool childRunning = false;
+bool onAlternateScreen = false;
 
 // Forward declaration
 void writeDate();
+void writeDiskUsage();
+bool sampleDisk();
 void drawInterface();
-void *workerForWriteDate(void *);
-bool sortAlphabetic(string one, string two);
-bool sortReverseAlphabetic(string one, string two);
+void drawPrompt(const string& searchKey);
+void showMessage(const string& message);
+void applyFilter();
+void onKeyboard(short revents);
+void handleKey(int c);
+void onResize();
+void onScan(short revents);
+void startScan();
+void stopScan();
+void onDirectoryChange(short revents);
+void catchUp();
+bool applyChanges(bool incremental);
+bool refreshName(const string& name, bool incremental);
+void rescan();
+bool loadListing();
+void finishRevalidating();
+size_t findListed(const string& name);
+string selectedName();
+void openItem(size_t item);
+bool openDirectory(const string& path);
+void launch(const string& filename);
+void onChildExit(pid_t pid, int status);
+bool sortListing(const ritems::item& one, const ritems::item& two);
 void sigintHandler(int signum);
-void exec_file(string filename);
 
 int main() {
-   // unbuffer output
-   cout << unitbuf;
-
-   // Clear screen
-   rt.clear();
-
-   // register SIGING handler
-   signal(SIGINT, sigintHandler);
+   // SIGINT and SIGWINCH arrive through the loop rather than interrupting
+   // it, so a handler never runs in the middle of drawing
+   loop.addSignal(SIGINT, [](const signalfd_siginfo&) {
+      // the child is in charge of the terminal until it exits
+      if (!childRunning) {
+         sigintHandler(SIGINT);
+      }
+   });
+   loop.addSignal(SIGWINCH, [](const signalfd_siginfo&) {
+      onResize();
+   });
    
+   const char* clockSetting = getenv("TRS80_CLOCK");
+   if (clockSetting && string(clockSetting) == "minutes") {
+      clockPeriod = 60;
+   }
+   const char* diskSetting = getenv("TRS80_DISK");
+   diskFollowsCwd = diskSetting && string(diskSetting) == "cwd";
+   const char* diskInterval = getenv("TRS80_DISK_INTERVAL");
+   if (diskInterval && *diskInterval) {
+      diskPeriod = max(atol(diskInterval), 0L);
+   }
+   sampleDisk();
+
    // Render the corner labels
    drawInterface();
 
-   // Get list of files in directory
-   vector<string> files;
-   vector<string> apps;
-   rt.moveCursor(1, 0);
-   for (const auto & entry : filesystem::directory_iterator(".")) {
-      // omit directories and whatnot
-      if (filesystem::is_regular_file(entry)) {
-         // get permissions using bitwise and (not logical and)
-         if ((filesystem::status(entry).permissions() & filesystem::perms::others_exec) != filesystem::perms::none) {
-            // executable
-            apps.push_back(entry.path().filename());
+   // Display the (still empty) list of files right away
+   fb = new FileBrowser(&screen, &files);
+
+   // and fill it in from last time's listing, or as the directory is
+   // read in the background
+   stat(".", &here);
+   scanner.directories = true;
+   if (loadListing()) {
+      fb->setItems(&files, filesWidest);
+      fb->redrawTable();
+   } else {
+      startScan();
+   }
+
+   // and keep it up to date after that
+   if (watcher.fd() >= 0) {
+      watcher.watch(".");
+      loop.addFd(watcher.fd(), POLLIN, onDirectoryChange);
+   }
+
+   // tick the clock as each second (or minute) starts
+   clockWatch = loop.addAligned(clockPeriod, []() {
+      // only the digits that changed get sent, and the cursor
+      // is put back at the prompt
+      writeDate();
+      screen.present();
+   });
+   if (clockWatch < 0) {
+      screen.put(0, 0, "Failure initializing clock.");
+   }
+
+   // and check the free space every so often, repainting it only if it
+   // changed
+   if (diskPeriod > 0) {
+      diskWatch = loop.addInterval(diskPeriod * 1000, []() {
+         if (sampleDisk()) {
+            writeDiskUsage();
+            screen.present();
+         }
+      });
+   }
+
+   // move the cursor to the prompt line
+   screen.setCursor(screen.lines - 1, 8);
+   screen.present();
+
+   // Character input
+   keyboardWatch = loop.addFd(keyboard.fd(), POLLIN, onKeyboard);
+
+   loop.run();
+
+   // exit
+   return 0;
+}
+
+/**
+ * @function onKeyboard
+ * Reads whatever the keyboard has and handles every key in it, so a
+ * burst of keys (or a paste) costs a single frame.
+ */
+void onKeyboard(short) {
+   if (keyboard.fill() == 0 && keyboard.available() == 0) {
+      // the terminal went away
+      rt.resetTerminal();
+      loop.stop();
+      return;
+   }
+
+   // everything these keys cause goes out in one write
+   rt.beginFrame();
+   while (keyboard.available() > 0 && !childRunning) {
+      handleKey(getch());
+   }
+   rt.endFrame();
+}
+
+/**
+ * @function handleKey
+ * Acts on one key from the keyboard.
+ * @param {int} c - the byte read.
+ */
+void handleKey(int c) {
+   if (c && c != ESCAPEKEY) {
+
+      if (c == FILTERKEY) {
+         // switch between completing names and narrowing the table
+         filterMode = !filterMode;
+         screen.put(screen.lines - 1, 0, filterMode ? "Filter: " : "Select: ");
+         if (filterMode) {
+            applyFilter();
          } else {
-            // not executable
-            files.push_back(entry.path().filename());
+            fb->setView(NULL);
+            fb->redrawTable();
+         }
+      } else if ((c == '\n') && (searchKey.length() == 0)) {
+         // open whatever is selected
+         if (fb->getItem() != string::npos) {
+            openItem(fb->getItem());
          }
+         return;
+      } else if ((c == '\n') && (searchKey.length() > 0)) {
+         // As per the original behavior of the TRS-80 Model 100,
+         // if the input is not the full name of a thing,
+         // clear buffer
+
+         // validate filename
+         size_t match = filesByName.find(searchKey);
+         if (match != string::npos) {
+            openItem(match);
+            return;
+         }
+
+         // when filtering, whatever is selected in the narrowed table
+         if (filterMode && fb->getItem() != string::npos) {
+            openItem(fb->getItem());
+            return;
+         }
+
+         // there were no matches!
+         // visually clear the area where the buffer is
+         screen.fill(screen.lines - 1, 8, width_utf8(searchKey));
+         // clear the buffer
+         searchKey = "";
+         applyFilter();
+      } else if ((c == '\t') && (searchKey.length() > 0)) {
+         // complete a unique match, or as far as all the matches agree
+         searchKey = filesByName.complete(searchKey);
+         applyFilter();
+      } else if (((c == 0x08) || (c == 0x7f)) && (searchKey.length() == 0)) {
+         // backspace with nothing to delete goes up a directory
+         openDirectory("..");
+         return;
+      } else if ((c == 0x08) || (c == 0x7f)) {
+         // backspace!
+         pop_back_utf8(searchKey);
+         applyFilter();
+      } else if (c >= 0x20 ) {
+         // a regular old letter
+         searchKey.push_back(c);
+         applyFilter();
+      }
+      
+      drawPrompt(searchKey);
+      screen.present();
+   } else {
+      int resultant = resolveEscapeSequence();
+
+      if (resultant == KEY_RIGHT) {
+         fb->pressedRight();
+      } else if (resultant == KEY_LEFT) {
+         fb->pressedLeft();
+      } else if (resultant == KEY_UP) {
+         fb->pressedUp();
+      } else if (resultant == KEY_DOWN) {
+         fb->pressedDown();
       }
    }
+}
 
-   // sort alphabetically
-   stable_sort(apps.begin(), apps.end(), sortReverseAlphabetic);
-   stable_sort(files.begin(), files.end(), sortAlphabetic);
-   
-   // prepend files with apps
-   for (auto appname : apps) {
-      files.emplace(files.begin(), appname);
+/**
+ * @function onScan
+ * Merges what the scanner has read so far into the sorted list and
+ * redraws the page if that changed it, so the first files show up before
+ * a big directory has been read all the way through.
+ */
+void onScan(short) {
+   scanner.collect(scanned);
+   if (revalidating) {
+      // nothing is shown until it's compared with what already is
+      if (scanner.done()) {
+         finishRevalidating();
+      }
+      return;
    }
-   
 
-   // Display list of files
-   fb = new FileBrowser(&rt, &files);
-   
+   bool done = scanner.done();
+   if (!scanned.empty() && (done || files.size() < mergeEveryBatch || scanned.size() * 4 >= files.size())) {
+      // only the new names need measuring
+      size_t widest = 0;
+      for (size_t i = 0; i < scanned.size(); i++) {
+         widest = max(widest, FileBrowser::itemWidth(scanned, i));
+      }
+      filesWidest = max(filesWidest, widest);
 
-   // start clock worker
-   int rc;
-   pthread_t thr[1];
-   thread_data_t thr_data[1];
-   clock_loop = true;
-   pthread_mutex_init(&lock_x, NULL);
-   thr_data[0].tid = 1;
-   if ((rc = pthread_create(&thr[0], NULL, workerForWriteDate, &thr_data[0]))) {
-      return 1;
-      rt.saveCursor();
-      rt.moveCursor(0, 0);
-      cout << "Failure initializing clock." << endl;
-      rt.restoreCursor();
-   } 
+      // the highlight stays on the file it's on, unless it's still at
+      // the top, where it stays
+      size_t selected = filterMode ? string::npos : fb->getItem();
+      string selectedFile;
+      uint16_t selectedFlags = RI_NONE;
+      if (selected != string::npos && selected > 0) {
+         selectedFile = files[selected];
+         selectedFlags = files.flags(selected);
+      }
 
-   // move the cursor to the prompt line
-   rt.moveCursor(rt.lines - 1, 8);
+      // directories, then apps, then files, each alphabetically
+      size_t before = files.size();
+      files.append(scanned);
+      scanned.clear();
+      size_t first = files.mergeSorted(before, sortListing);
 
-   // Character input loop
-   int c;
-   string searchKey = "";
-   while(true) {
-      c = getch();
-      
-      // lock cout mutex
-      pthread_mutex_lock(&lock_x);
-   
-      if (c && c != ESCAPEKEY) {
-
-         if ((c == '\n') && (searchKey.length() == 0)) {
-            // get index
-            size_t i = fb->getIndex();
-            int childpid = -1;
-            childpid = fork();
-            if (childpid == 0) {
-               // in child process
-               exec_file(files.at(i));
-            } else if (childpid < 0) {
-               // error
-            } else if (childpid > 0) {
-               // in parent
-               wait(NULL);
-               // clear the screen
-               rt.clear();
-               // draw the corner labels
-               drawInterface();
-               // reset the cursor for the filebrowser
-               fb->setIndex(0);
-               // redraw the center panel
-               fb->redrawTable();
-            }
-         } else if ((c == '\n') && (searchKey.length() > 0)) {
-            // As per the original behavior of the TRS-80 Model 100,
-            // if the input is not the full name of a thing,
-            // clear buffer
-
-            // validate filename
-            int childpid = -1;
-            for (auto candidate : files) {
-               if (candidate.find(searchKey) == 0 && candidate.length() == searchKey.length()) {
-                  // fork exec
-                  childpid = fork();
-                  if (childpid == 0) {
-                     // in child process
-                     exec_file(searchKey);
-                  } else if (childpid < 0) {
-                     // error
-                  }
-                  break;
-               }
-            }
-
-            // check if found match
-            if (childpid > 0) {
-               // found match and in parent
-               wait(NULL);
-               // clear the screen
-               rt.clear();
-               // draw the corner labels
-               drawInterface();
-               // reset the cursor for the filebrowser
-               fb->setIndex(0);
-               // redraw the center panel
-               fb->redrawTable();
-               // clear the buffer
-               searchKey = "";
-            } else {
-               // there were no matches!
-               // visually clear the area where the buffer is
-               rt.moveCursor(rt.lines - 1, 8);
-               cout << setw(length_utf8(searchKey)) << "";
-               // clear the buffer
-               searchKey = "";
-            }
-               
-         } else if ((c == '\t') && (searchKey.length() > 0)) {
-            // scan for partial matches
-            vector<string> autocompletes;
-            for (auto candidate : files) {
-               if (candidate.find(searchKey) == 0) {
-                  autocompletes.push_back(candidate);
-               }
-            }
-
-            // if only one match, autocomplete
-            if (autocompletes.size() == 1) {
-               searchKey = autocompletes[0];
-            }
-         } else if ((c == 0x08) || (c == 0x7f)) {
-            // backspace!
-            pop_back_utf8(searchKey);
-         } else if (c >= 0x20 ) {
-            // a regular old letter
-            searchKey.push_back(c);
+      size_t reselected = string::npos;
+      if (!selectedFile.empty() && selected >= first) {
+         reselected = files.lowerBound(selectedFile, selectedFlags, sortListing);
+      }
+      bool pageChanged = fb->addedItems(widest, first, reselected);
+      filesByName.invalidate();
+      filesFuzzy.invalidate();
+
+      if (!childRunning && (pageChanged || filterMode)) {
+         rt.beginFrame();
+         if (filterMode) {
+            applyFilter();
+         } else {
+            fb->redrawTable();
          }
-         
-         // move cursor to prompt line
-         rt.moveCursor(rt.lines - 1, 8);
-         // print length + 1 blanks
-         cout << setw(length_utf8(searchKey) + 1) << "";
-            
-         // move cursor to prompt line
-         rt.moveCursor(rt.lines - 1, 8);
-         // print searchKey in full
-         cout << searchKey;
+         rt.endFrame();
+      }
+   }
+
+   if (done) {
+      stopScan();
+      files.shrink_to_fit();
+      snapshots.save(here, files, filesWidest);
+      snapshotStale = false;
+
+      // anything that changed while it was being read
+      if (!childRunning) {
+         rt.beginFrame();
+         catchUp();
+         rt.endFrame();
+      }
+
+      // put the cursor back where it was the last time we were here
+      if (reselect.length() > 0) {
+         size_t item = filesByName.find(reselect);
+         reselect = "";
+         if (item != string::npos && !filterMode && !childRunning) {
+            rt.beginFrame();
+            fb->setIndex(item);
+            rt.endFrame();
+         }
+      }
+   }
+}
+
+/**
+ * @function startScan
+ * Starts reading the current directory in the background; onScan fills
+ * the list in as it goes.
+ */
+void startScan() {
+   if (scanner.start(".")) {
+      scanWatch = loop.addFd(scanner.fd(), POLLIN, onScan);
+   }
+}
+
+/**
+ * @function stopScan
+ * Stops reading the directory, finished or not.
+ */
+void stopScan() {
+   if (scanWatch >= 0) {
+      loop.removeFd(scanWatch);
+      scanWatch = -1;
+   }
+   scanner.stop();
+   revalidating = false;
+   scanned.clear();
+}
+
+/**
+ * @function onDirectoryChange
+ * Collects the names inotify says changed and, unless a scan or a child
+ * is running, patches them into the list straight away.
+ */
+void onDirectoryChange(short) {
+   watcher.fill();
+   rdirEvent event;
+   while (watcher.next(event)) {
+      if (event.overflowed) {
+         rescanNeeded = true;
       } else {
-         int resultant = resolveEscapeSequence();
-   
-         if (resultant == KEY_RIGHT) {
-            fb->pressedRight();
-         } else if (resultant == KEY_LEFT) {
-            fb->pressedLeft();
-         } else if (resultant == KEY_UP) {
-            fb->pressedUp();
-         } else if (resultant == KEY_DOWN) {
-            fb->pressedDown();
+         pendingChanges.push_back(event.name);
+      }
+   }
+
+   if (!childRunning) {
+      rt.beginFrame();
+      catchUp();
+      rt.endFrame();
+   }
+}
+
+/**
+ * @function catchUp
+ * Applies the pending changes, unless the directory is still being
+ * read (they're applied once it has been).  Keeps the same file selected.
+ */
+void catchUp() {
+   if (scanWatch >= 0) {
+      return;
+   }
+   if (rescanNeeded) {
+      rescan();
+      return;
+   }
+
+   // with a filter, the narrowed table is worked out again instead
+   string selected = selectedName();
+   if (applyChanges(!filterMode) && filterMode) {
+      applyFilter();
+      fb->selectItem(findListed(selected));
+   }
+}
+
+/**
+ * @function applyChanges
+ * Brings every pending name up to date.
+ * @param {bool} incremental - if true, the table is told about each
+ * insert and removal and repaints just the cells that moved; otherwise
+ * it's only handed the new list and the caller redraws.
+ * @returns {bool} true if the list changed.
+ */
+bool applyChanges(bool incremental) {
+   bool changed = false;
+   for (const string& name : pendingChanges) {
+      changed |= refreshName(name, incremental);
+   }
+   pendingChanges.clear();
+   if (!changed) {
+      return false;
+   }
+
+   filesByName.invalidate();
+   filesFuzzy.invalidate();
+   snapshotStale = true;
+   if (!incremental) {
+      fb->setItems(&files, filesWidest);
+   }
+   return true;
+}
+
+/**
+ * @function refreshName
+ * Makes one name's place in the list match the directory: adds it if it
+ * appeared, removes it if it went, and moves it if it changed kind (e.g.
+ * became executable).  The list stays sorted throughout.
+ * @param {const string&} name - the name that changed.
+ * @param {bool} incremental - tell the table about it (see applyChanges).
+ * @returns {bool} true if the list changed.
+ */
+bool refreshName(const string& name, bool incremental) {
+   uint16_t flags = rscan::classify(AT_FDCWD, name.c_str(), DT_UNKNOWN, true);
+   size_t index = findListed(name);
+   if (index != string::npos && files.flags(index) == flags) {
+      return false;
+   }
+
+   if (index != string::npos) {
+      files.erase(index);
+      if (incremental) {
+         fb->removedItem(index);
+      }
+   }
+   if (flags != RSCAN_SKIP) {
+      index = files.insertSorted(name, flags, sortListing);
+      size_t width = FileBrowser::itemWidth(files, index);
+      filesWidest = max(filesWidest, width);
+      if (incremental) {
+         fb->insertedItem(index, width);
+      }
+   }
+   return true;
+}
+
+/**
+ * @function rescan
+ * Reads the directory again from scratch, for when inotify lost track.
+ * The same file is selected again once it's found.
+ */
+void rescan() {
+   reselect = selectedName();
+   stopScan();
+   rescanNeeded = false;
+   pendingChanges.clear();
+   files.clear();
+   filesWidest = 0;
+   filesByName.invalidate();
+   filesFuzzy.invalidate();
+   fb->setItems(&files, 0);
+   fb->setIndex(0);
+   startScan();
+}
+
+/**
+ * @function loadListing
+ * Fills the list in from the snapshot saved the last time this directory
+ * was read, and starts reading it in the background anyway: even if its
+ * mtime hasn't changed, a file may have been made executable since.
+ * finishRevalidating patches in whatever turns out to be different.
+ * @returns {bool} false if there's no snapshot (the caller scans).
+ */
+bool loadListing() {
+   bool current;
+   if (!snapshots.load(here, files, filesWidest, current)) {
+      return false;
+   }
+   filesByName.invalidate();
+   filesFuzzy.invalidate();
+   snapshotStale = !current;
+
+   startScan();
+   revalidating = scanWatch >= 0;
+   return true;
+}
+
+/**
+ * @function finishRevalidating
+ * Compares the directory as just read with the list loaded from its
+ * snapshot.  Both are sorted the same way, so one walk through them
+ * finds every name that was added, removed or changed kind; those are
+ * patched in like inotify's changes, and the snapshot saved again if
+ * anything was different.
+ */
+void finishRevalidating() {
+   scanned.mergeSorted(0, sortListing);
+
+   size_t i = 0;
+   size_t j = 0;
+   while (i < files.size() || j < scanned.size()) {
+      if (j == scanned.size() || (i < files.size() && sortListing(files.at(i), scanned.at(j)))) {
+         pendingChanges.push_back(string(files[i++]));
+      } else if (i == files.size() || sortListing(scanned.at(j), files.at(i))) {
+         pendingChanges.push_back(string(scanned[j++]));
+      } else {
+         i++;
+         j++;
+      }
+   }
+   stopScan();
+
+   if (!childRunning) {
+      rt.beginFrame();
+      catchUp();
+      rt.endFrame();
+   }
+   if (snapshotStale && pendingChanges.empty() && scanWatch < 0) {
+      snapshots.save(here, files, filesWidest);
+      snapshotStale = false;
+   }
+}
+
+/**
+ * @function findListed
+ * Binary-searches the list for a name, in each of the groups it's
+ * sorted into.
+ * @param {const string&} name - the name.
+ * @returns {size_t} its index, or string::npos.
+ */
+size_t findListed(const string& name) {
+   if (name.length() == 0) {
+      return string::npos;
+   }
+   for (uint16_t kind : {RI_DIRECTORY, RI_EXECUTABLE, RI_NONE}) {
+      size_t index = files.lowerBound(name, kind, sortListing);
+      if (index < files.size() && files[index] == name) {
+         return index;
+      }
+   }
+   return string::npos;
+}
+
+/**
+ * @function selectedName
+ * @returns {string} the name of the selected file, or "" if none.
+ */
+string selectedName() {
+   size_t item = fb->getItem();
+   return (item != string::npos) ? string(files[item]) : "";
+}
+
+/**
+ * @function openItem
+ * Opens a directory, or runs anything else.
+ * @param {size_t} item - the index in files.
+ */
+void openItem(size_t item) {
+   if (files.flags(item) & RI_DIRECTORY) {
+      openDirectory(string(files[item]));
+   } else {
+      launch(string(files[item]));
+   }
+}
+
+/**
+ * @function openDirectory
+ * Makes another directory the current one and shows it: instantly if
+ * it was shown recently and hasn't changed since, otherwise by scanning
+ * it.  The one being left is remembered, along with its selection.
+ * @param {const string&} path - the directory, relative to this one.
+ * @returns {bool} false if it couldn't be entered.
+ */
+bool openDirectory(const string& path) {
+   struct stat there;
+   if (stat(path.c_str(), &there) < 0 || !S_ISDIR(there.st_mode)) {
+      return false;
+   }
+
+   // going up, the directory we came out of is the natural selection
+   string cameFrom;
+   char cwd[PATH_MAX];
+   if (path == ".." && getcwd(cwd, sizeof cwd)) {
+      cameFrom = filesystem::path(cwd).filename().native();
+   }
+
+   if (chdir(path.c_str()) < 0) {
+      return false;
+   }
+   watcher.watch(".");
+   pendingChanges.clear();
+   rescanNeeded = false;
+
+   // remember this one (its listing too, if it finished loading), and
+   // save it for next time if it's changed since it was last saved
+   if (scanWatch < 0 && snapshotStale) {
+      snapshots.save(here, files, filesWidest);
+      snapshotStale = false;
+   }
+   size_t item = fb->getItem();
+   visited.put(here, files, filesWidest, (item != string::npos) ? string(files[item]) : "", scanWatch < 0);
+   stopScan();
+   files.clear();
+   filesByName.invalidate();
+   filesFuzzy.invalidate();
+   here = there;
+
+   // a new directory starts with an empty buffer
+   screen.fill(screen.lines - 1, 8, width_utf8(searchKey));
+   searchKey = "";
+   drawPrompt(searchKey);
+
+   size_t selection = 0;
+   if (visited.take(here, files, filesWidest, reselect)) {
+      fb->setItems(&files, filesWidest);
+      if (reselect.length() > 0) {
+         selection = filesByName.find(reselect);
+         if (selection == string::npos) {
+            selection = 0;
          }
       }
+      reselect = "";
+   } else if (loadListing()) {
+      fb->setItems(&files, filesWidest);
+      if (reselect.length() == 0) {
+         reselect = cameFrom;
+      }
+      selection = filesByName.find(reselect);
+      if (selection == string::npos) {
+         selection = 0;
+      }
+      reselect = "";
+   } else {
+      filesWidest = 0;
+      fb->setItems(&files, 0);
+      if (reselect.length() == 0) {
+         reselect = cameFrom;
+      }
+      startScan();
+   }
 
-      // unlock cout mutex
-      pthread_mutex_unlock(&lock_x);
+   // a different directory may be on a different filesystem
+   if (diskFollowsCwd && sampleDisk()) {
+      writeDiskUsage();
    }
 
-   // Send signal to clock worker
-   clock_loop = false;
+   // the table has changed completely, so this redraws all of it
+   fb->setIndex(selection);
+   return true;
+}
 
-   // wait for clock worker to terminate
-   pthread_join(thr[0], NULL);
+/**
+ * @function onResize
+ * Lays everything out again if the terminal's size really changed.
+ */
+void onResize() {
+   if (childRunning) {
+      // a child that's running gets the new size itself, and we
+      // relayout when it exits
+      return;
+   }
+   if (!rt.checkResize()) {
+      return;
+   }
+   rt.beginFrame();
+   screen.resize(rt.lines, rt.cols);
+   drawInterface();
+   drawPrompt(searchKey);
+   fb->redrawTable();
+   rt.endFrame();
+}
 
-   // exit
-   return 0;
+/**
+ * @function launch
+ * Hands the terminal to a child running the file, on the alternate
+ * screen if there is one so that menu's own screen is still there when
+ * it exits.  The loop keeps running (the clock just stops drawing) and
+ * onChildExit takes the terminal back.
+ * @param {const string&} filename - the file to run.
+ */
+void launch(const string& filename) {
+   // give the child a normal terminal, and a screen of its own
+   keyboard.suspend();
+   onAlternateScreen = rt.enterAlternateScreen();
+   // don't let the child inherit half a frame
+   rt.flush();
+
+   // TODO: dynamically detect which way to run the file rather
+   // than blanketly using vi
+   rspawn launcher;
+   sigset_t mask;
+   rloop::childSignalMask(mask);
+   launcher.setSignalMask(mask);
+   pid_t childpid = launcher.start({"vi", "./" + filename});
+   if (childpid < 0) {
+      // nothing ran (vi is missing, say), so the terminal is still ours
+      keyboard.resume();
+      if (onAlternateScreen) {
+         rt.leaveAlternateScreen();
+         screen.forgetCursor();
+         onAlternateScreen = false;
+      }
+      showMessage(string("Failed to exec: ") + strerror(launcher.error));
+      return;
+   }
+
+   childRunning = true;
+   loop.setEnabled(keyboardWatch, false);
+   // nobody sees the clock meanwhile, so don't wake up for it
+   loop.setEnabled(clockWatch, false);
+   loop.setEnabled(diskWatch, false);
+   loop.watchChild(childpid, onChildExit);
+}
+
+/**
+ * @function onChildExit
+ * Takes the terminal back from a child.  Coming back from the alternate
+ * screen, the terminal still shows menu as it was, so only what changed
+ * meanwhile (the clock, the buffer, files the child made) is sent;
+ * otherwise, or if the terminal was resized, everything is redrawn.
+ */
+void onChildExit(pid_t, int) {
+   childRunning = false;
+   keyboard.resume();
+   loop.setEnabled(keyboardWatch, true);
+   loop.setEnabled(clockWatch, true);
+   loop.setEnabled(diskWatch, true);
+   // the child may well have written files
+   sampleDisk();
+
+   // the child may have been resized under us
+   bool resized = rt.checkResize();
+
+   rt.beginFrame();
+   bool intact = onAlternateScreen && rt.leaveAlternateScreen() && !resized;
+   onAlternateScreen = false;
+   if (intact) {
+      // just the cursor and attributes are unknown
+      screen.forgetCursor();
+      writeDate();
+      writeDiskUsage();
+      screen.fill(screen.lines - 1, 8, width_utf8(searchKey));
+   } else {
+      // the child drew all over the terminal
+      screen.resize(rt.lines, rt.cols);
+      // draw the corner labels
+      drawInterface();
+   }
+   // clear the buffer (and any filter), but stay on the same file
+   string selected = selectedName();
+   searchKey = "";
+   fb->setView(NULL);
+   // pick up whatever the child created or deleted
+   if (rescanNeeded) {
+      rescan();
+   } else if (scanWatch < 0) {
+      applyChanges(false);
+   }
+   // (after a full redraw, this draws the whole center panel again)
+   fb->selectItem(findListed(selected));
+   drawPrompt(searchKey);
+   screen.present();
+   rt.endFrame();
 }
 
 /**
@@ -293,87 +911,154 @@ int main() {
  * Clears the screen and draws out the corner text fields that
  * are visible on the menu screen of the TRS-80 Model 100.
  * Time, copyright, prompt, and available storage space.
+ * Drawn into the back buffer; shows up on the next present().
  */
 void drawInterface() {
    // Clear screen
-   rt.clear();
+   screen.clear();
 
    // Write date (top left)
    writeDate();
 
    // Write copyright (top right)
    string copyright = "(C) Renee Waverly Sonntag";
-   rt.moveCursor(0, rt.cols - copyright.length());
-   cout << copyright;
+   screen.put(0, screen.cols - copyright.length(), copyright);
 
    // Write prompt (bottom left)
-   rt.moveCursor(rt.lines - 1, 0);
-   cout << "Select: ";
+   screen.put(screen.lines - 1, 0, filterMode ? "Filter: " : "Select: ");
 
    // Write disk usage (bottom right)
-   rt.moveCursor(rt.lines - 1, rt.cols - 30);
-   filesystem::space_info root = filesystem::space("/");
-   cout << right << setw(19) << root.available << " Bytes free";
+   writeDiskUsage();
 }
 
 /**
- * @function writeDate
- * Places the date string in the rop left corner of the screen.
- * Interestingly, it will always be the same length, so we
- * should be fine with just simply writing over it every second.
+ * @function writeDiskUsage
+ * Places the space available (as last sampled) in the bottom right
+ * corner.
  */
-void writeDate() {
-   rt.moveCursor(0,0);
-   auto now = time(nullptr);
-   cout << put_time(localtime(&now), "%b %d, %Y %a %H:%M:%S");
+void writeDiskUsage() {
+   ostringstream diskUsage;
+   diskUsage << right << setw(19) << diskFree << " Bytes free";
+   screen.put(screen.lines - 1, screen.cols - 30, diskUsage.str());
 }
 
 /**
- * @function workerForWriteDate
+ * @function sampleDisk
+ * Asks how much space is available to us on the filesystem shown.
+ * @returns {bool} true if it's different from the last sample.
  */
-void *workerForWriteDate(void *arg) {
-   thread_data_t *data = (thread_data_t *)arg;
-
-   cout << unitbuf;
-
-   while (clock_loop) {
-      // wait 1 second
-      sleep(1);
+bool sampleDisk() {
+   struct statvfs info;
+   if (statvfs(diskFollowsCwd ? "." : "/", &info) < 0) {
+      return false;
+   }
+   // what filesystem::space() calls available
+   unsigned long long available = (unsigned long long) info.f_bavail * info.f_frsize;
+   if (available == diskFree) {
+      return false;
+   }
+   diskFree = available;
+   return true;
+}
 
-      // Lock cout
-      pthread_mutex_lock(&lock_x);
+/**
+ * @function drawPrompt
+ * Draws the contents of the "Select:" buffer and leaves the cursor
+ * after it.
+ * @param {const string&} searchKey - the buffer contents.
+ */
+void drawPrompt(const string& searchKey) {
+   // blank width + 1 cells on the prompt line (or any message there)
+   screen.fill(screen.lines - 1, 8, max(width_utf8(searchKey) + 1, messageWidth));
+   messageWidth = 0;
 
-      // Save the cursor position
-      rt.saveCursor();
+   // print searchKey in full and leave the cursor after it
+   size_t end = screen.put(screen.lines - 1, 8, searchKey);
+   screen.setCursor(screen.lines - 1, end);
+}
 
-      // Write the date
-      writeDate();
+/**
+ * @function showMessage
+ * Shows a message in place of the "Select:" buffer (which is emptied)
+ * until something is typed.
+ * @param {const string&} message - what to say.
+ */
+void showMessage(const string& message) {
+   screen.fill(screen.lines - 1, 8, max(width_utf8(searchKey) + 1, messageWidth));
+   searchKey = "";
+   applyFilter();
 
-      // Restore the cursor position
-      rt.restoreCursor();
+   // up to the "Bytes free" field
+   size_t room = (screen.cols > 39) ? screen.cols - 39 : 0;
+   string shown = truncate_utf8(message, room);
+   messageWidth = width_utf8(shown);
+   size_t end = screen.put(screen.lines - 1, 8, shown, RS_REVERSE);
+   screen.setCursor(screen.lines - 1, end);
+   screen.present();
+}
 
-      // unlock cout
-      pthread_mutex_unlock(&lock_x);
+/**
+ * @function applyFilter
+ * In filter mode, narrows the table down to the files fuzzily matching
+ * the buffer, best first (all of them if it's empty).  Each keystroke
+ * builds on the last one's matches.
+ */
+void applyFilter() {
+   if (!filterMode) {
+      return;
    }
-
-   // clean up
-   pthread_exit(NULL);
+   if (searchKey.length() > 0) {
+      fb->setView(&filesFuzzy.filter(searchKey), &filesFuzzy);
+   } else {
+      fb->setView(NULL);
+   }
+   fb->redrawTable();
 }
 
 /**
- * @function sortAlphabetic
- * Via stable_sort sorts alphabetically
+ * @function writeDate
+ * Places the date string in the top left corner of the screen.
+ * Interestingly, it will always be the same length, so we
+ * should be fine with just simply writing over it.  Within a minute
+ * only the seconds are worked out (and written), the rest is formatted
+ * once a minute or when the screen was cleared.
  */
-bool sortAlphabetic(string one, string two) {
-   return one < two;
+void writeDate() {
+   time_t now = time(nullptr);
+   if (now < clockMinute || now >= clockMinute + 60 || clockGeneration != screen.generation) {
+      struct tm local;
+      localtime_r(&now, &local);
+      char date[64];
+      strftime(date, sizeof date, (clockPeriod < 60) ? "%b %d, %Y %a %H:%M:" : "%b %d, %Y %a %H:%M", &local);
+      clockColumn = screen.put(0, 0, date);
+      clockMinute = now - min(local.tm_sec, 59);
+      clockGeneration = screen.generation;
+   }
+
+   if (clockPeriod < 60) {
+      long seconds = now - clockMinute;
+      char digits[3] = {(char) ('0' + seconds / 10), (char) ('0' + seconds % 10), '\0'};
+      screen.put(0, clockColumn, digits);
+   }
 }
 
 /**
- * @function sortReverseAlphabetic
- * Via stable_sort sorts reverse alphabetically
+ * @function sortListing
+ * Via ritems::sort puts directories first, then executables, then
+ * everything else, each alphabetically.
  */
-bool sortReverseAlphabetic(string one, string two) {
-   return one > two;
+bool sortListing(const ritems::item& one, const ritems::item& two) {
+   bool oneDirectory = one.flags & RI_DIRECTORY;
+   bool twoDirectory = two.flags & RI_DIRECTORY;
+   if (oneDirectory != twoDirectory) {
+      return oneDirectory;
+   }
+   bool oneApp = one.flags & RI_EXECUTABLE;
+   bool twoApp = two.flags & RI_EXECUTABLE;
+   if (oneApp != twoApp) {
+      return oneApp;
+   }
+   return one.name < two.name;
 }
 
 /**
@@ -389,24 +1074,3 @@ void sigintHandler(int signum) {
 
    exit(signum);
 }
-
-/**
- * @function exec_file
- * Finds a suitable executable for the provided file, or
- * executes it directly.
- * Handles failure by displaying message before yielding back
- * to the parent process.
- * @param {string} filename - the file
- */
-void exec_file(string filename) {
-   // in child process
-   // TODO: dynamically detect which way to run the file rather
-   // than blanketly using vim
-   execlp("vi", "vi", ("./" + filename).c_str(), NULL);
-   // if reached, exec failed
-   rt.clear();
-   cout << "Failed to exec." << endl;
-   cout << "Press any key to continue...";
-   getch();
-   exit(-1);
-}
@@ -28,9 +28,15 @@
  *              [ ] delay
  */
 
+#include <ctype.h>
 #include <signal.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <chrono>
+#include <deque>
+#include <fstream>
 #include <string>
 #include <sstream>
 #include <map>
@@ -43,20 +49,60 @@
 
 // Keyboard
 #include "../../include/rkeyboard.h"
+#include "../../include/revdev.h"
+
+// Event loop
+#include "../../include/rloop.h"
+#include "../../include/rspawn.h"
 
 using namespace std;
 
+// What the tape recorder is doing
+enum transport_t {
+   STOPPED,
+   RECORDING,
+   PLAYING
+};
+
 // Forward declarations
 void drawFunctionLabels();
+void onKeyboard(short);
+void onKeyEvents(short);
+bool wantKeyEvents();
+bool onForegroundConsole();
+bool isEcho(const int key);
+void handleKey(const int resultant);
+void startChild(const char* program, const transport_t newState, const char* message);
+void onChildExit(pid_t pid, int status);
 
 rterm rt;
 rtui ui(&rt);
+rloop loop;
+
+// the TRS-80 keyboard's own event node, when asked for with
+// TRS80_KEYBOARD=evdev (or a recording with TRS80_KEYBOARD_REPLAY)
+revdev keys;
+int keysWatch = -1;
+
+// Keys taken from the event node that the console will also send
+// through the tty; those copies are dropped, anything else on the tty
+// (ssh, another keyboard) is handled as usual
+struct keyEcho {
+   int key;
+   chrono::steady_clock::time_point when;
+};
+deque<keyEcho> echoes;
+
+string midiport;
+map<string, string> midiports;
+
+transport_t transport = STOPPED;
+pid_t childpid = 0;
+bool stopRequested = false;
 
 #define ESCAPEKEY 27
 
 int main(void) {
-   string midiport;
-
    rt.clear();
 
    // Function key labels
@@ -69,7 +115,6 @@ int main(void) {
    // get the midi ports
    string rawports = rt.exec("arecordmidi -l");
    istringstream rawportlist(rawports);
-   map<string, string> midiports;
    while (!rawportlist.eof()) {
       // get the actual port number
       string portnum;
@@ -81,95 +126,226 @@ int main(void) {
       midiports.emplace(portnum, description);
    } 
 
-   // Character input loop
-   int c;
-   int childpid = 0;
-   while(true) {
-      c = getch();
-   
-      if (c && c != ESCAPEKEY) {
-         // do nothing
-      } else {
-         // process key press
-         int resultant = resolveEscapeSequence();
-
-         // check for child process ended
-         if (childpid != 0) {
-            int status;
-            waitpid(childpid, &status, WNOHANG);
-
-            if (WIFEXITED(status)) {
-               // child exited on its own
-               childpid = 0;
-            } else if (WIFSIGNALED(status)) {
-               // child exited with failure?
-               childpid = 0;
-            } else {
-               if (resultant != KEY_F5 && resultant != KEY_F8) {
-                  // don't bother doing anything with the key press
-                  // We're already either playing or recording
-                  continue;
-               }
-               // else keys F5 and F8 proceed
-            }
-         }
+   // Keys and the recorder/player all come through one loop,
+   // so the screen updates the moment a child finishes
+   loop.addFd(rkeyboard::session().fd(), POLLIN, onKeyboard);
+   if (wantKeyEvents() && keys.open()) {
+      keysWatch = loop.addFd(keys.fd(), POLLIN, onKeyEvents);
+   }
+   loop.run();
+
+   rt.resetTerminal();
+   return 0;
+}
+
+/**
+ * @function onKeyboard
+ * Handles every key the keyboard has ready.
+ */
+void onKeyboard(short) {
+   rkeyboard& keyboard = rkeyboard::session();
+   if (keyboard.fill() == 0 && keyboard.available() == 0) {
+      // the terminal went away
+      loop.stop();
+      return;
+   }
 
-         if (resultant == KEY_F1) {
-            // f1
-            childpid = fork();
-            if (childpid == 0) {
-               execlp("arecordmidi", "arecordmidi", ("--port=" + midiport).c_str(), "filename.mid");
-               cout << "Failed! (Could not exec.)" << endl;
-               exit(-1);
-            } else if (childpid < 0) {
-               cout << "Failed! (Could not fork.)" << endl;
-               childpid = 0;
-            } else {
-               // parent process
-               cout << "Recording... ";
-            }
-         } else if (resultant == KEY_F2) {
-            // f2
-            childpid = fork();
-            if (childpid == 0) {
-               execlp("aplaymidi", "aplaymidi", ("--port=" + midiport).c_str(), "filename.mid");
-               cout << "Failed! (Could not exec.)" << endl;
-               exit(-1);
-            } else if (childpid < 0) {
-               cout << "Failed! (Could not fork.)" << endl;
-               childpid = 0;
-            } else {
-               // parent process
-               cout << "Playing... ";
-            }
-         } else if (resultant == KEY_F3) {
-            // f3
-            cout << "last track" << endl;
-         } else if (resultant == KEY_F4) {
-            // f4
-            cout << "next track" << endl;
-         } else if (resultant == KEY_F5) {
-            // f5
-            if (childpid != 0) {
-               cout << "Stopped" << endl;
-               // interrupt, don't kill or terminate
-               // we want arecordmidi to finish saving its buffer
-               kill(childpid, SIGINT);
-               childpid = 0;
-            } else {
-               cout << "Nothing to stop." << endl;
-            }
-         } else if (resultant == KEY_F6) {
-            // f6
-         } else if (resultant == KEY_F7) {
-            // f7
-            for (auto& x: midiports)
-               cout << x.first << ":" << x.second << endl;
-         } else if (resultant == KEY_F8) {
-            // f8
-            rt.resetTerminal();
-            exit(0);
+   rt.beginFrame();
+   while (keyboard.available() > 0) {
+      int c = getch();
+      if (!c || c == ESCAPEKEY) {
+         int key = resolveEscapeSequence();
+         if (!isEcho(key)) {
+            handleKey(key);
          }
       }
    }
+   rt.endFrame();
+}
+
+/**
+ * @function onKeyEvents
+ * Handles a batch of key events from the keyboard's event node.
+ * Falls back to the tty if the node goes away (or a replay ends).
+ * While another VT is in front the keys aren't ours, so they're
+ * read and let go.
+ */
+void onKeyEvents(short) {
+   if (keys.fill() == 0 && keys.finished()) {
+      loop.removeFd(keysWatch);
+      keysWatch = -1;
+      keys.close();
+      echoes.clear();
+      return;
+   }
+
+   bool replaying = keys.isReplay();
+   bool ours = replaying || onForegroundConsole();
+   auto now = chrono::steady_clock::now();
+
+   rt.beginFrame();
+   rkeyEvent event;
+   while (keys.next(event)) {
+      if (!ours || event.key < 0 || event.value == REVDEV_RELEASE) {
+         continue;
+      }
+      // the console sends bytes for repeats too
+      if (!replaying) {
+         echoes.push_back({event.key, now});
+      }
+      if (event.value == REVDEV_PRESS) {
+         handleKey(event.key);
+      }
+   }
+   rt.endFrame();
+}
+
+/**
+ * @function wantKeyEvents
+ * @returns {bool} true if the event node should be used, which has to be
+ * asked for: without a grab it only makes sense on the console the
+ * keyboard is plugged into.
+ */
+bool wantKeyEvents() {
+   const char* backend = getenv("TRS80_KEYBOARD");
+   const char* recording = getenv("TRS80_KEYBOARD_REPLAY");
+   return (backend && string(backend) == "evdev") || (recording && *recording);
+}
+
+/**
+ * @function onForegroundConsole
+ * @returns {bool} true if our tty is the VT currently on screen, the one
+ * the keyboard's keys go to.  Never true over ssh or in a terminal
+ * emulator.
+ */
+bool onForegroundConsole() {
+   const char* name = ttyname(STDIN_FILENO);
+   if (!name || strncmp(name, "/dev/tty", 8) != 0 || !isdigit((unsigned char) name[8])) {
+      return false;
+   }
+   string active;
+   ifstream("/sys/class/tty/tty0/active") >> active;
+   return active == name + 5;
+}
+
+/**
+ * @function isEcho
+ * Whether a key decoded from the tty is the console's copy of one
+ * already taken from the event node; if so it's used up.
+ * @param {const int} key - the decoded key.
+ * @returns {bool} true if it should be dropped.
+ */
+bool isEcho(const int key) {
+   // anything the console hasn't sent by now isn't coming
+   auto now = chrono::steady_clock::now();
+   while (!echoes.empty() && now - echoes.front().when > chrono::milliseconds(500)) {
+      echoes.pop_front();
+   }
+   for (auto it = echoes.begin(); it != echoes.end(); it++) {
+      if (it->key == key) {
+         echoes.erase(it);
+         return true;
+      }
+   }
+   return false;
+}
+
+/**
+ * @function handleKey
+ * Acts on one function key.
+ * @param {const int} resultant - the decoded key.
+ */
+void handleKey(const int resultant) {
+   if (transport != STOPPED && resultant != KEY_F5 && resultant != KEY_F8) {
+      // don't bother doing anything with the key press
+      // We're already either playing or recording
+      return;
+   }
+
+   if (resultant == KEY_F1) {
+      // f1
+      startChild("arecordmidi", RECORDING, "Recording... ");
+   } else if (resultant == KEY_F2) {
+      // f2
+      startChild("aplaymidi", PLAYING, "Playing... ");
+   } else if (resultant == KEY_F3) {
+      // f3
+      rt.write("last track\n");
+   } else if (resultant == KEY_F4) {
+      // f4
+      rt.write("next track\n");
+   } else if (resultant == KEY_F5) {
+      // f5
+      if (transport != STOPPED) {
+         // interrupt, don't kill or terminate
+         // we want arecordmidi to finish saving its buffer;
+         // onChildExit reports it once it has
+         stopRequested = true;
+         kill(childpid, SIGINT);
+      } else {
+         rt.write("Nothing to stop.\n");
+      }
+   } else if (resultant == KEY_F6) {
+      // f6
+   } else if (resultant == KEY_F7) {
+      // f7
+      for (auto& x: midiports)
+         rt.write(x.first + ":" + x.second + "\n");
+   } else if (resultant == KEY_F8) {
+      // f8
+      rt.resetTerminal();
+      exit(0);
+   }
+}
+
+/**
+ * @function startChild
+ * Runs arecordmidi or aplaymidi on the current track.
+ * @param {const char*} program - the program to run.
+ * @param {const transport_t} newState - what the transport is doing while it runs.
+ * @param {const char*} message - shown once it's running.
+ */
+void startChild(const char* program, const transport_t newState, const char* message) {
+   // the child shouldn't inherit half a frame
+   rt.flush();
+
+   // the keyboard stays ours while it runs
+   rspawn launcher;
+   sigset_t mask;
+   rloop::childSignalMask(mask);
+   launcher.setSignalMask(mask);
+   launcher.redirect(STDIN_FILENO, "/dev/null", O_RDONLY);
+   pid_t pid = launcher.start({program, "--port=" + midiport, "filename.mid"});
+   if (pid < 0) {
+      rt.write(string("Failed! (Could not exec: ") + strerror(launcher.error) + ")\n");
+      return;
+   }
+
+   // parent process
+   childpid = pid;
+   transport = newState;
+   stopRequested = false;
+   rt.write(message);
+   loop.watchChild(pid, onChildExit);
+}
+
+/**
+ * @function onChildExit
+ * Brings the transport back to stopped as soon as the recorder or player
+ * exits, whether it finished, was stopped, or failed.
+ */
+void onChildExit(pid_t, int status) {
+   rt.beginFrame();
+   if (stopRequested) {
+      rt.write("Stopped\n");
+   } else if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+      rt.write("Done\n");
+   } else {
+      rt.write("Failed! (" + rspawn::describe(status) + ")\n");
+   }
+   rt.endFrame();
+
+   childpid = 0;
+   transport = STOPPED;
+   stopRequested = false;
 }